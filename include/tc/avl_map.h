@@ -0,0 +1,223 @@
+#pragma once
+
+#ifndef TC_AVL_MAP_H
+#define TC_AVL_MAP_H
+
+#include "tc/avl_tree.h"
+
+#include <cstddef>
+#include <functional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace tc
+{
+
+	// Ordered map whose tree nodes hold only the key, the links and the index
+	// of the value; values live in one contiguous vector. A search therefore
+	// touches key-sized nodes only, whatever the size of V, and a value is
+	// reached with a single indexed load after it. Erasing moves the last
+	// value into the hole, so the values stay dense; pointers and references
+	// to values are invalidated by any insert or erase.
+	template<typename K, typename V, typename Comp = std::less<K>, typename Policy = avl_default_policy>
+	class avl_map
+	{
+		static_assert(!Policy::multi && !Policy::lazy, "avl_map needs one node per key");
+
+		struct tree_policy : Policy
+		{
+			using node_extra = avl_slot<typename Policy::node_extra>;
+		};
+
+	public:
+		using size_type = std::size_t;
+		using key_type = K;
+		using mapped_type = V;
+		using tree_type = avl_tree<K, Comp, tree_policy>;
+		using node_type = typename tree_type::node_type;
+
+		avl_map() = default;
+
+		// The copied tree has new nodes; the owners are looked up again.
+		avl_map(const avl_map& other) : _tree(other._tree), _values(other._values), _owners(other._values.size())
+		{
+			for (const node_type* n = leftmost(); n != nullptr; n = avl_next(n))
+				_owners[n->slot] = n;
+		}
+
+		avl_map(avl_map&&) noexcept = default;
+
+		avl_map& operator=(avl_map other) noexcept
+		{
+			swap(other);
+			return *this;
+		}
+
+		void swap(avl_map& other) noexcept
+		{
+			_tree.swap(other._tree);
+			_values.swap(other._values);
+			_owners.swap(other._owners);
+		}
+
+		size_type size() const
+		{ return _tree.size(); }
+
+		bool empty() const
+		{ return _tree.empty(); }
+
+		void clear()
+		{
+			_tree.clear();
+			_values.clear();
+			_owners.clear();
+		}
+
+		// The value of key, value-initialized first if key is new. A present
+		// key is only searched: its node and stored key stay as they are.
+		V& operator[](const K& key)
+		{
+			const node_type* n = _tree.find(key);
+			if (n == nullptr) {
+				n = _tree.insert(key);
+				add_value(n, V());
+			}
+			return _values[n->slot];
+		}
+
+		// Sets the value of key; true if key was new.
+		template<typename U>
+		bool insert_or_assign(const K& key, U&& value)
+		{
+			const node_type* n = _tree.find(key);
+			if (n != nullptr) {
+				_values[n->slot] = std::forward<U>(value);
+				return false;
+			}
+			add_value(_tree.insert(key), std::forward<U>(value));
+			return true;
+		}
+
+		// Removes key and its value; true if there was one.
+		bool erase(const K& key);
+
+		// The value of key or nullptr; the tree is only searched, the value
+		// is the one cache line touched outside it.
+		V* find(const K& key)
+		{
+			auto n = _tree.find(key);
+			return n ? &_values[n->slot] : nullptr;
+		}
+
+		const V* find(const K& key) const
+		{
+			auto n = _tree.find(key);
+			return n ? &_values[n->slot] : nullptr;
+		}
+
+		V& at(const K& key)
+		{
+			V* v = find(key);
+			if (v == nullptr)
+				throw std::out_of_range("avl_map: no such key");
+			return *v;
+		}
+
+		const V& at(const K& key) const
+		{
+			const V* v = find(key);
+			if (v == nullptr)
+				throw std::out_of_range("avl_map: no such key");
+			return *v;
+		}
+
+		bool contains(const K& key) const
+		{ return _tree.contains(key); }
+
+		// Calls f(key, value) in key order.
+		template<typename F>
+		void for_each(F f) const
+		{
+			for (const node_type* n = leftmost(); n != nullptr; n = avl_next(n))
+				f(n->key, _values[n->slot]);
+		}
+
+		template<typename F>
+		void for_each(F f)
+		{
+			for (const node_type* n = leftmost(); n != nullptr; n = avl_next(n))
+				f(n->key, _values[n->slot]);
+		}
+
+		// The keys alone, for the traversals in tree.h and parallel.h.
+		const tree_type& keys() const
+		{ return _tree; }
+
+	private:
+		static const size_type npos = ~size_type(0);
+
+		// Gives the new node n its value; n is erased again if that throws,
+		// so a failed insert leaves the map as it was.
+		template<typename U>
+		void add_value(const node_type* n, U&& value)
+		{
+			try {
+				_values.push_back(std::forward<U>(value));
+			} catch (...) {
+				_tree.erase(n->key);
+				throw;
+			}
+			try {
+				_owners.push_back(n);
+			} catch (...) {
+				_values.pop_back();
+				_tree.erase(n->key);
+				throw;
+			}
+			n->slot = _values.size() - 1;
+		}
+
+		const node_type* leftmost() const
+		{
+			auto n = _tree.croot();
+			if (n == nullptr)
+				return nullptr;
+			while (n->left != nullptr)
+				n = n->left;
+			return n;
+		}
+
+		tree_type _tree;
+		std::vector<V> _values;
+		std::vector<const node_type*> _owners; // node of each value
+	};
+
+	template<typename K, typename V, typename Comp, typename Policy>
+	const typename avl_map<K, V, Comp, Policy>::size_type avl_map<K, V, Comp, Policy>::npos;
+
+	template<typename K, typename V, typename Comp, typename Policy>
+	bool avl_map<K, V, Comp, Policy>::erase(const K& key) {
+		auto n = _tree.find(key);
+		if (n == nullptr)
+			return false;
+		const size_type slot = n->slot;
+		_tree.erase(key);
+		if (slot + 1 != _values.size()) {
+			_values[slot] = std::move(_values.back());
+			_owners[slot] = _owners.back();
+			_owners[slot]->slot = slot;
+		}
+		_values.pop_back();
+		_owners.pop_back();
+		return true;
+	}
+
+	template<typename K, typename V, typename Comp, typename Policy>
+	void swap(avl_map<K, V, Comp, Policy>& a, avl_map<K, V, Comp, Policy>& b) noexcept {
+		a.swap(b);
+	}
+
+}
+
+#endif
@@ -3,18 +3,105 @@
 #ifndef TC_AVL_TREE_H
 #define TC_AVL_TREE_H
 
+#include <algorithm>
+#include <atomic>
 #include <functional>
+#include <new>
 #include <utility>
 #include <queue>
 #include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
 
 namespace tc
 {
 
-	template<typename T>
-	struct avl_node
+	inline void avl_prefetch(const void* p)
+	{
+#if defined(__GNUC__)
+		__builtin_prefetch(p);
+#else
+		(void)p;
+#endif
+	}
+
+	// Node base without extra fields.
+	struct avl_no_extra
+	{
+		template<typename T>
+		explicit avl_no_extra(const T&)
+		{ }
+
+		// Orders two keys by their cached data; 0 means undecided.
+		int precompare(const avl_no_extra&) const
+		{ return 0; }
+	};
+
+	// Node base caching the first 8 bytes of a string key as a big-endian
+	// integer, so most descent steps compare integers without touching the
+	// string's heap buffer. Only valid for the plain lexicographic order
+	// (std::less<std::string>, three_way<std::string>).
+	struct avl_key_prefix
+	{
+		std::uint64_t prefix;
+
+		explicit avl_key_prefix(const std::string& key) : prefix(0)
+		{
+			const std::size_t n = std::min<std::size_t>(key.size(), sizeof(prefix));
+			for (std::size_t i = 0; i < n; ++i)
+				prefix |= std::uint64_t(static_cast<unsigned char>(key[i])) << (8 * (sizeof(prefix) - 1 - i));
+		}
+
+		int precompare(const avl_key_prefix& other) const
+		{ return prefix < other.prefix ? -1 : (prefix > other.prefix ? 1 : 0); }
+	};
+
+	// Node base adding a duplicate count on top of another base, see
+	// avl_multiset_policy.
+	template<typename Base = avl_no_extra>
+	struct avl_counted : Base
+	{
+		std::size_t count;
+
+		template<typename T>
+		explicit avl_counted(const T& key) : Base(key), count(1)
+		{ }
+	};
+
+	// Node base adding the index of a value kept outside the tree on top of
+	// another base, see avl_map. The index is not part of the key, so the map
+	// may set it through the const nodes the tree hands out.
+	template<typename Base = avl_no_extra>
+	struct avl_slot : Base
+	{
+		mutable std::size_t slot;
+
+		template<typename T>
+		explicit avl_slot(const T& key) : Base(key), slot(~std::size_t(0))
+		{ }
+	};
+
+	// Node base adding an erased mark on top of another base, see
+	// avl_lazy_policy.
+	template<typename Base = avl_no_extra>
+	struct avl_tombstone : Base
+	{
+		bool dead;
+
+		template<typename T>
+		explicit avl_tombstone(const T& key) : Base(key), dead(false)
+		{ }
+	};
+
+	template<typename T, typename Extra = avl_no_extra>
+	struct avl_node : Extra
 	{
 		using value_type = T;
+		using extra_type = Extra;
 		using balance_type = signed char;
 
 		static const balance_type LH = -1;  // Left heavy.
@@ -30,213 +117,1331 @@ namespace tc
 		{ return b == LH ? left : right; }
 
 		avl_node(avl_node* p, const T& k)
-			: parent(p), left(nullptr), right(nullptr), balance(0), key(k)
+			: Extra(k), parent(p), left(nullptr), right(nullptr), balance(0), key(k)
+		{ }
+	};
+
+	// Comparators returning <0, 0 or >0 are marked with an is_three_way member
+	// type, the way transparent comparators are marked with is_transparent.
+	template<typename Comp, typename = void>
+	struct is_three_way : std::false_type
+	{ };
+
+	template<typename Comp>
+	struct is_three_way<Comp, decltype((void)std::declval<typename Comp::is_three_way>())> : std::true_type
+	{ };
+
+	template<typename T>
+	struct three_way
+	{
+		using is_three_way = void;
+
+		int operator()(const T& a, const T& b) const
+		{ return a < b ? -1 : (b < a ? 1 : 0); }
+	};
+
+	// One pass over the characters instead of up to two for operator<.
+	template<typename C, typename Tr, typename A>
+	struct three_way<std::basic_string<C, Tr, A>>
+	{
+		using is_three_way = void;
+
+		int operator()(const std::basic_string<C, Tr, A>& a, const std::basic_string<C, Tr, A>& b) const
+		{ return a.compare(b); }
+	};
+
+	// Turns a less-than comparator such as std::less into a three-way one.
+	template<typename Less>
+	struct three_way_adapter
+	{
+		using is_three_way = void;
+
+		three_way_adapter(const Less& less = Less()) : less(less)
+		{ }
+
+		template<typename T>
+		int operator()(const T& a, const T& b) const
+		{ return less(a, b) ? -1 : (less(b, a) ? 1 : 0); }
+
+		Less less;
+	};
+
+	// Snapshot of avl_tree operation counters.
+	struct avl_stats
+	{
+		std::uint64_t comparisons = 0;
+		std::uint64_t single_rotations = 0;
+		std::uint64_t double_rotations = 0;
+		std::uint64_t inserts = 0;
+		std::uint64_t insert_visits = 0; // nodes visited descending for inserts
+		std::uint64_t erases = 0;
+		std::uint64_t erase_visits = 0;
+		std::uint64_t lookups = 0;
+		std::uint64_t lookup_visits = 0;
+		std::uint64_t allocations = 0;
+		std::uint64_t deallocations = 0;
+		std::size_t bytes_held = 0; // gauge, survives reset()
+	};
+
+	// Statistics policy that records nothing; every hook compiles away.
+	struct avl_no_stats
+	{
+		void comparison() { }
+		void rotation(bool) { }
+		void insert(std::size_t) { }
+		void erase(std::size_t) { }
+		void lookup(std::size_t) { }
+		void allocated(std::size_t) { }
+		void deallocated(std::size_t) { }
+		avl_stats snapshot() const { return avl_stats(); }
+		void reset() { }
+	};
+
+	struct avl_counting_stats
+	{
+		void comparison() { ++_s.comparisons; }
+		void rotation(bool twice) { ++(twice ? _s.double_rotations : _s.single_rotations); }
+		void insert(std::size_t visits) { ++_s.inserts; _s.insert_visits += visits; }
+		void erase(std::size_t visits) { ++_s.erases; _s.erase_visits += visits; }
+		void lookup(std::size_t visits) { ++_s.lookups; _s.lookup_visits += visits; }
+		void allocated(std::size_t bytes) { ++_s.allocations; _s.bytes_held += bytes; }
+		void deallocated(std::size_t bytes) { ++_s.deallocations; _s.bytes_held -= bytes; }
+		avl_stats snapshot() const { return _s; }
+		void reset()
+		{
+			auto held = _s.bytes_held;
+			_s = avl_stats();
+			_s.bytes_held = held;
+		}
+
+	private:
+		avl_stats _s;
+	};
+
+	// Counters of a negative-lookup filter. A probe the filter passes but the
+	// tree misses is a false positive; the rate is taken over all misses.
+	struct avl_filter_stats
+	{
+		std::uint64_t probes = 0;
+		std::uint64_t negatives = 0;       // misses answered by the filter alone
+		std::uint64_t false_positives = 0;
+		std::uint64_t rebuilds = 0;
+		std::size_t bits = 0;
+
+		double false_positive_rate() const
+		{
+			const auto misses = negatives + false_positives;
+			return misses ? double(false_positives) / misses : 0.0;
+		}
+	};
+
+	// No filter: every key may be present; every hook compiles away.
+	struct avl_no_filter
+	{
+		template<typename K> bool may_contain(const K&) const { return true; }
+		template<typename K> void add(const K&) { }
+		void removed() { }
+		void false_positive() const { }
+		bool stale(std::size_t) const { return false; }
+		template<typename ForEachKey> void rebuild(std::size_t, ForEachKey) { }
+		void clear() { }
+		avl_filter_stats snapshot() const { return avl_filter_stats(); }
+	};
+
+	// std::hash followed by a 64-bit finalizer, since std::hash of an
+	// integer is often the integer itself.
+	struct avl_mixed_hash
+	{
+		template<typename K>
+		std::uint64_t operator()(const K& key) const
+		{
+			std::uint64_t h = std::hash<K>()(key);
+			h ^= h >> 33;
+			h *= 0xff51afd7ed558ccdull;
+			h ^= h >> 33;
+			h *= 0xc4ceb9fe1a85ec53ull;
+			h ^= h >> 33;
+			return h;
+		}
+	};
+
+	// Blocked Bloom filter: a key sets k bits inside one 64-byte block, so a
+	// probe costs one cache line instead of one node per tree level. Sized at
+	// BitsPerKey for twice the tree's keys; about 1% false positives at 10.
+	// Erased keys leave their bits behind, which can only add false
+	// positives, so instead of deleting the filter is rebuilt from the tree
+	// once it is outgrown or half its keys are gone. Hash must agree with the
+	// tree's comparator: equivalent keys, equal hashes.
+	// Only add, removed and rebuild write the bits, and the tree calls them
+	// from its non-const members; the counters a const probe bumps are
+	// relaxed atomics, so concurrent lookups are safe.
+	template<typename Hash = avl_mixed_hash, std::size_t BitsPerKey = 10>
+	class avl_bloom_filter
+	{
+	public:
+		static const unsigned block_bits = 512;
+		static const unsigned hashes = BitsPerKey * 7 / 10 < 1 ? 1 : BitsPerKey * 7 / 10;
+
+		avl_bloom_filter() : _capacity(0), _keys(0), _removed(0), _probes(0), _negatives(0), _false_positives(0)
 		{ }
+
+		// The atomic counters make the copy and move members explicit; the
+		// moves stay noexcept for avl_tree::swap.
+		avl_bloom_filter(const avl_bloom_filter& other)
+			: _blocks(other._blocks), _capacity(other._capacity), _keys(other._keys), _removed(other._removed), _s(other._s)
+		{ copy_counters(other); }
+
+		avl_bloom_filter(avl_bloom_filter&& other) noexcept
+			: _blocks(std::move(other._blocks)), _capacity(other._capacity), _keys(other._keys), _removed(other._removed), _s(other._s)
+		{ copy_counters(other); }
+
+		avl_bloom_filter& operator=(const avl_bloom_filter& other)
+		{
+			avl_bloom_filter copy(other);
+			return *this = std::move(copy);
+		}
+
+		avl_bloom_filter& operator=(avl_bloom_filter&& other) noexcept
+		{
+			_blocks = std::move(other._blocks);
+			_capacity = other._capacity;
+			_keys = other._keys;
+			_removed = other._removed;
+			_s = other._s;
+			copy_counters(other);
+			return *this;
+		}
+
+		template<typename K>
+		bool may_contain(const K& key) const
+		{
+			_probes.fetch_add(1, std::memory_order_relaxed);
+			if (_blocks.empty())
+				return true;
+			const std::uint64_t h = Hash()(key);
+			const std::uint64_t* block = &_blocks[block_of(h)];
+			std::uint32_t g = static_cast<std::uint32_t>(h), step = static_cast<std::uint32_t>(h >> 32) | 1u;
+			for (unsigned i = 0; i < hashes; ++i, g += step) {
+				const unsigned bit = g % block_bits;
+				if ((block[bit / 64] & (std::uint64_t(1) << (bit % 64))) == 0) {
+					_negatives.fetch_add(1, std::memory_order_relaxed);
+					return false;
+				}
+			}
+			return true;
+		}
+
+		template<typename K>
+		void add(const K& key)
+		{
+			++_keys;
+			if (_blocks.empty())
+				return; // not built yet; the first rebuild picks the key up
+			const std::uint64_t h = Hash()(key);
+			std::uint64_t* block = &_blocks[block_of(h)];
+			std::uint32_t g = static_cast<std::uint32_t>(h), step = static_cast<std::uint32_t>(h >> 32) | 1u;
+			for (unsigned i = 0; i < hashes; ++i, g += step) {
+				const unsigned bit = g % block_bits;
+				block[bit / 64] |= std::uint64_t(1) << (bit % 64);
+			}
+		}
+
+		void removed()
+		{ ++_removed; }
+
+		void false_positive() const
+		{ _false_positives.fetch_add(1, std::memory_order_relaxed); }
+
+		// True when the filter should be rebuilt for a tree of size keys.
+		bool stale(std::size_t size) const
+		{ return _blocks.empty() || size > _capacity || 2 * _removed > _keys; }
+
+		template<typename ForEachKey>
+		void rebuild(std::size_t size, ForEachKey for_each_key)
+		{
+			_capacity = 2 * size < 64 ? 64 : 2 * size;
+			const std::size_t words = block_bits / 64;
+			const std::size_t blocks = (_capacity * BitsPerKey + block_bits - 1) / block_bits;
+			_blocks.assign(blocks * words, 0);
+			_keys = _removed = 0;
+			for_each_key([this](const auto& key) { add(key); });
+			++_s.rebuilds;
+			_s.bits = blocks * block_bits;
+		}
+
+		void clear()
+		{
+			_blocks.clear();
+			_capacity = _keys = _removed = 0;
+		}
+
+		avl_filter_stats snapshot() const
+		{
+			avl_filter_stats s = _s;
+			s.probes = _probes.load(std::memory_order_relaxed);
+			s.negatives = _negatives.load(std::memory_order_relaxed);
+			s.false_positives = _false_positives.load(std::memory_order_relaxed);
+			return s;
+		}
+
+	private:
+		void copy_counters(const avl_bloom_filter& other)
+		{
+			_probes.store(other._probes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			_negatives.store(other._negatives.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			_false_positives.store(other._false_positives.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		}
+
+		std::size_t block_of(std::uint64_t h) const
+		{
+			const std::size_t blocks = _blocks.size() / (block_bits / 64);
+			// The positions inside the block come from h itself, the block
+			// from a remix of it.
+			const std::uint64_t b = (h * 0x9e3779b97f4a7c15ull) >> 32;
+			return static_cast<std::size_t>(b * blocks >> 32) * (block_bits / 64);
+		}
+
+		std::vector<std::uint64_t> _blocks;
+		std::size_t _capacity;
+		std::size_t _keys;
+		std::size_t _removed;
+		avl_filter_stats _s; // rebuilds and bits
+		mutable std::atomic<std::uint64_t> _probes;
+		mutable std::atomic<std::uint64_t> _negatives;
+		mutable std::atomic<std::uint64_t> _false_positives;
+	};
+
+	// Compile-time options of avl_tree. Derive and override what is needed.
+	struct avl_default_policy
+	{
+		// Validate the nodes touched by every insert/erase, throwing
+		// std::logic_error on the first broken invariant.
+		static const bool checked = false;
+		// Operation counters, see avl_counting_stats. Lookups count too, with
+		// plain increments: with counting on, const members no longer run
+		// safely side by side.
+		using stats_type = avl_no_stats;
+		// Negative-lookup filter consulted before descending, see avl_bloom_filter.
+		using filter_type = avl_no_filter;
+		// Base of every node, see avl_key_prefix.
+		using node_extra = avl_no_extra;
+		// Keep equivalent keys as one node with a count (node_extra must be
+		// an avl_counted) instead of overwriting the stored key.
+		static const bool multi = false;
+		// erase() only marks the node (node_extra must be an avl_tombstone);
+		// marked nodes are dropped in one compact() pass once they make up
+		// more than dead_percent of the nodes; 100 leaves compact() to the caller.
+		static const bool lazy = false;
+		static const unsigned dead_percent = 25;
+	};
+
+	struct avl_checked_policy : avl_default_policy
+	{
+		static const bool checked = true;
+	};
+
+	struct avl_stats_policy : avl_default_policy
+	{
+		using stats_type = avl_counting_stats;
+	};
+
+	struct avl_prefix_policy : avl_default_policy
+	{
+		using node_extra = avl_key_prefix;
+	};
+
+	struct avl_multiset_policy : avl_default_policy
+	{
+		using node_extra = avl_counted<>;
+		static const bool multi = true;
+	};
+
+	struct avl_filter_policy : avl_default_policy
+	{
+		using filter_type = avl_bloom_filter<>;
 	};
 
-	template<typename T, typename Comp = std::less<T>>
+	struct avl_lazy_policy : avl_default_policy
+	{
+		using node_extra = avl_tombstone<>;
+		static const bool lazy = true;
+	};
+
+	template<typename T, typename Comp = std::less<T>, typename Policy = avl_default_policy>
 	class avl_tree
 	{
 	public:
 		using size_type = std::size_t;
 		using value_type = T;
-		using node_type = avl_node<T>;
+		using node_type = avl_node<T, typename Policy::node_extra>;
+		using extra_type = typename Policy::node_extra;
 		using node_ptr = node_type*;
 		using const_node_ptr = const node_ptr;
 		using balance_type = typename node_type::balance_type;
+		using policy_type = Policy;
 
 		static const balance_type LH = node_type::LH; // Left heavy.
 		static const balance_type RH = node_type::RH; // Right heavy.
 
-		avl_tree() : _root(nullptr), _size(0u)
+		avl_tree() : _root(nullptr), _leftmost(nullptr), _rightmost(nullptr), _size(0u), _distinct(0u), _dead(0u)
 		{ }
 
+		// Clones the structure node by node: keys, balances and links are
+		// copied as they are, without comparisons or rotations.
+		avl_tree(const avl_tree& other);
+
+		avl_tree(avl_tree&& other) noexcept
+			: _comp(other._comp), _root(nullptr), _leftmost(nullptr), _rightmost(nullptr), _size(0u), _distinct(0u), _dead(0u)
+		{ swap(other); }
+
+		avl_tree& operator=(const avl_tree& other)
+		{
+			avl_tree copy(other);
+			swap(copy);
+			return *this;
+		}
+
+		avl_tree& operator=(avl_tree&& other) noexcept
+		{
+			avl_tree taken(std::move(other));
+			swap(taken);
+			return *this;
+		}
+
+		~avl_tree()
+		{ clear(); }
+
+		// Exchanges contents, comparators and statistics in O(1).
+		void swap(avl_tree& other) noexcept
+		{
+			using std::swap;
+			swap(_comp, other._comp);
+			swap(_root, other._root);
+			swap(_leftmost, other._leftmost);
+			swap(_rightmost, other._rightmost);
+			swap(_size, other._size);
+			swap(_distinct, other._distinct);
+			swap(_stats, other._stats);
+			swap(_filter, other._filter);
+			swap(_dead, other._dead);
+		}
+
+		// Frees every node in O(n) without recursion or extra memory.
+		void clear();
+
+		bool empty() const
+		{ return _root == nullptr; }
+
+		// Number of keys, duplicates included.
 		size_type size() const
 		{ return _size; }
 
-		void insert(const T& value);
+		// Number of nodes, i.e. of distinct keys.
+		size_type distinct_size() const
+		{ return _distinct; }
+
+		// Occurrences of key: 0 or 1 for a set, the stored count in multi mode.
+		size_type count(const T& key) const
+		{
+			auto n = find(key);
+			return n == nullptr ? 0 : node_count(n, std::integral_constant<bool, Policy::multi>());
+		}
+
+		// Returns the node now holding value.
+		const node_type* insert(const T& value)
+		{ return insert(nullptr, value); }
+
+		// Starts from hint, a node of this tree (e.g. the previous insertion
+		// point), and climbs only as far as needed: inserting next to the hint
+		// costs O(1) amortized plus rebalancing. A null hint means the root.
+		const node_type* insert(const node_type* hint, const T& value);
+
+		// Fast path for keys arriving in ascending order: starts at the
+		// rightmost node and links there directly when value is the new maximum.
+		const node_type* append(const T& value)
+		{ return insert(_rightmost, value); }
 
+		// Removes one occurrence of key.
 		void erase(const T& key);
 
+		// Smallest and largest key in O(1); the tree must not be empty.
+		const T& min() const
+		{
+			assert(_leftmost != nullptr);
+			return _leftmost->key;
+		}
+
+		const T& max() const
+		{
+			assert(_rightmost != nullptr);
+			return _rightmost->key;
+		}
+
+		// Removes one occurrence of the smallest (largest) key and returns it.
+		// No search: O(1) amortized plus rebalancing. Like min() and max(),
+		// only asserted to have a key; on an empty tree the behavior is
+		// undefined in release builds.
+		T pop_min()
+		{
+			assert(_leftmost != nullptr);
+			T v = _leftmost->key;
+			_stats.erase(1);
+			erase_node(_leftmost);
+			purge_extremes();
+			return v;
+		}
+
+		T pop_max()
+		{
+			assert(_rightmost != nullptr);
+			T v = _rightmost->key;
+			_stats.erase(1);
+			erase_node(_rightmost);
+			purge_extremes();
+			return v;
+		}
+
+		// Node holding an equivalent key or nullptr.
+		const node_type* find(const T& key) const;
+
+		bool contains(const T& key) const
+		{ return find(key) != nullptr; }
+
+		// find() for keys[0, n) into out[0, n). Up to batch_width descents
+		// advance in lockstep, each prefetching its next node before the others
+		// take a step, so the cache misses of independent lookups overlap.
+		void find_batch(const T* keys, size_type n, const node_type** out) const;
+
+		void find_batch(const std::vector<T>& keys, std::vector<const node_type*>& out) const
+		{
+			out.resize(keys.size());
+			find_batch(keys.data(), keys.size(), out.data());
+		}
+
+		// contains() for keys[0, n) into out[0, n); returns how many were found.
+		size_type contains_batch(const T* keys, size_type n, bool* out) const;
+
+		static const size_type batch_width = 16;
+
 		const node_type* croot() const
 		{ return _root; }
 
+		Comp key_comp() const
+		{ return _comp; }
+
+		// Node of min(), cached like it; nullptr on an empty tree.
+		const node_type* cleftmost() const
+		{ return _leftmost; }
+
+		avl_stats stats() const
+		{ return _stats.snapshot(); }
+
+		// Nodes marked erased but still linked, lazy mode only.
+		size_type dead_size() const
+		{ return _dead; }
+
+		// Frees the nodes marked erased and relinks the others as a perfectly
+		// balanced tree: O(n), no comparisons, no rotations.
+		void compact();
+
+		// Counters of the negative-lookup filter, all zero without one.
+		avl_filter_stats filter_stats() const
+		{ return _filter.snapshot(); }
+
+		// Rebuilds the negative-lookup filter from the live keys now. Inserts
+		// and erases rebuild it on their own once it goes stale; this only
+		// moves the cost, e.g. ahead of a read-only phase.
+		void rebuild_filter()
+		{
+			_filter.rebuild(_distinct, [this](auto add) {
+				for (const node_type* n = _leftmost; n != nullptr; n = avl_next(n))
+					if (!is_dead(n))
+						add(n->key);
+			});
+		}
+
+		// Zeroes the counters; bytes_held keeps tracking live nodes.
+		void reset_stats()
+		{ _stats.reset(); }
+
 	private:
+		static size_type node_count(const node_type* n, std::true_type)
+		{ return n->count; }
+
+		static size_type node_count(const node_type*, std::false_type)
+		{ return 1; }
+
+		// Bumps the count of an existing node in multi mode.
+		static bool add_duplicate(node_ptr n, std::true_type)
+		{
+			++n->count;
+			return true;
+		}
+
+		static bool add_duplicate(node_ptr, std::false_type)
+		{ return false; }
+
+		// Drops one occurrence unless it is the last one.
+		static bool remove_duplicate(node_ptr n, std::true_type)
+		{
+			if (n->count == 1)
+				return false;
+			--n->count;
+			return true;
+		}
+
+		static bool remove_duplicate(node_ptr, std::false_type)
+		{ return false; }
+
+		static bool is_dead(const node_type* n)
+		{ return is_dead(n, std::integral_constant<bool, Policy::lazy>()); }
+
+		static bool is_dead(const node_type* n, std::true_type)
+		{ return n->dead; }
+
+		static bool is_dead(const node_type*, std::false_type)
+		{ return false; }
+
+		static void set_dead(node_ptr n, bool dead, std::true_type)
+		{ n->dead = dead; }
+
+		static void set_dead(node_ptr, bool, std::false_type)
+		{ }
+
+		// Keeps min() and max() O(1): marked nodes never stay at the ends.
+		void purge_extremes()
+		{
+			while (_leftmost != nullptr && is_dead(_leftmost))
+				erase_node(_leftmost);
+			while (_rightmost != nullptr && is_dead(_rightmost))
+				erase_node(_rightmost);
+		}
+
+		static node_ptr build_balanced(node_ptr* nodes, size_type n, node_ptr parent);
+
+		// Compares key a, whose node extra is ax, with node n: cached data
+		// first, the comparator only if that is undecided.
+		int compare(const T& a, const extra_type& ax, const node_type* n) const
+		{
+			int c = ax.precompare(*n);
+			return c != 0 ? c : compare(a, n->key);
+		}
+
+		// <0, 0, >0 like a three-way comparator, counting calls to _comp.
+		int compare(const T& a, const T& b) const
+		{ return compare(a, b, is_three_way<Comp>()); }
+
+		int compare(const T& a, const T& b, std::true_type) const
+		{
+			_stats.comparison();
+			return _comp(a, b);
+		}
+
+		int compare(const T& a, const T& b, std::false_type) const
+		{
+			_stats.comparison();
+			if (_comp(a, b))
+				return -1;
+			_stats.comparison();
+			return _comp(b, a) ? 1 : 0;
+		}
+
+		node_ptr make_node(node_ptr parent, const T& v)
+		{
+			_stats.allocated(sizeof(node_type));
+			node_ptr n = new node_type(parent, v);
+			_filter.add(v);
+			return n;
+		}
+
+		void free_node(node_ptr n)
+		{
+			_stats.deallocated(sizeof(node_type));
+			_filter.removed();
+			delete n;
+		}
+
+		// Copy of n, extra fields included, hung under parent without children.
+		node_ptr clone_node(const node_type* n, node_ptr parent)
+		{
+			_stats.allocated(sizeof(node_type));
+			node_ptr c = new node_type(*n);
+			c->parent = parent;
+			c->left = c->right = nullptr;
+			return c;
+		}
+
+		// False if the filter rules key out. Reads only: the filter is kept
+		// fresh by the non-const members, see refresh_filter.
+		bool filter_passes(const T& key) const
+		{ return _filter.may_contain(key); }
+
+		// Rebuilds the filter once the tree has outgrown it or shed half its
+		// keys; called at the end of every insert and erase, so the cost is
+		// amortized over the updates that made it stale.
+		void refresh_filter()
+		{
+			if (_filter.stale(_distinct))
+				rebuild_filter();
+		}
+
+		node_ptr insert_existing(node_ptr n, const T& v);
+		void erase_node(node_ptr n);
+		node_ptr insert_fixup(node_ptr n);
+		void replace_child(node_ptr old, node_ptr repl);
+		node_ptr rotate(node_ptr n, balance_type a);
+		node_ptr erase_fixup(node_ptr p, balance_type d);
+
+		int check_node(const node_type* n) const;
+		void check_order(const node_type* n) const;
+		void check_path(const node_type* lowest, const node_type* top) const;
+
 		Comp _comp;
-		avl_node<T>* _root;
+		node_ptr _root;
+		node_ptr _leftmost;
+		node_ptr _rightmost;
 		size_type _size;
+		size_type _distinct;
+		mutable typename Policy::stats_type _stats;
+		typename Policy::filter_type _filter;
+		size_type _dead;
 	};
 
-	template<typename T>
-	void assignParent(avl_node<T>* n, avl_node<T>* p) {
+	template<typename N>
+	void assignParent(N* n, N* p) {
 		if (n != nullptr) n->parent = p;
 	}
 
-	template<typename T, typename Comp>
-	void avl_tree<T, Comp>::insert(const T& v) {
-		if (_root == nullptr) {
-			_root = new avl_node<T>(nullptr, v);
-			_size = 1;
-			return;
+	// In-order neighbours, following parent links.
+	template<typename N>
+	N* avl_next(N* n) {
+		if (n->right) {
+			n = n->right;
+			while (n->left) n = n->left;
+			return n;
 		}
+		while (n->parent && n->parent->right == n) n = n->parent;
+		return n->parent;
+	}
 
-		auto rebalance = _root;
-		auto parent = _root->parent;
-		auto cur = _root;
-		bool goLeft;
-		while (cur) {
-			if (cur->balance != 0)
-				rebalance = cur;
-			parent = cur;
-			goLeft = _comp(v, cur->key);
-			if (goLeft) {
-				cur = cur->left;
+	template<typename N>
+	N* avl_prev(N* n) {
+		if (n->left) {
+			n = n->left;
+			while (n->right) n = n->right;
+			return n;
+		}
+		while (n->parent && n->parent->left == n) n = n->parent;
+		return n->parent;
+	}
+
+	// Height of the subtree under n, read from the stored balances in O(height).
+	template<typename N>
+	int avl_height(const N* n) {
+		int h = 0;
+		for (; n != nullptr; ++h)
+			n = n->balance > 0 ? n->right : n->left;
+		return h;
+	}
+
+	template<typename T, typename Comp, typename Policy>
+	void avl_tree<T, Comp, Policy>::replace_child(node_ptr old, node_ptr repl) {
+		auto p = old->parent;
+		if (p == nullptr)
+			_root = repl;
+		else if (p->left == old)
+			p->left = repl;
+		else
+			p->right = repl;
+		assignParent(repl, p);
+	}
+
+	// Lifts n->link(a) into n's place; balances are left to the caller.
+	template<typename T, typename Comp, typename Policy>
+	typename avl_tree<T, Comp, Policy>::node_ptr avl_tree<T, Comp, Policy>::rotate(node_ptr n, balance_type a) {
+		auto c = n->link(a);
+		n->link(a) = c->link(-a);
+		assignParent(n->link(a), n);
+		c->link(-a) = n;
+		replace_child(n, c);
+		n->parent = c;
+		return c;
+	}
+
+	// Retraces from p, whose d side just got one level shorter. Returns the
+	// topmost node whose balance or links were changed.
+	template<typename T, typename Comp, typename Policy>
+	typename avl_tree<T, Comp, Policy>::node_ptr avl_tree<T, Comp, Policy>::erase_fixup(node_ptr p, balance_type d) {
+		for (;;) {
+			node_ptr top = p;
+			if (p->balance == d) {
+				p->balance = 0; // shorter, keep going up
+			} else if (p->balance == 0) {
+				p->balance = -d;
+				return p;
 			} else {
-				bool goRight = _comp(cur->key, v);
-				if (goRight) {
-					cur = cur->right;
+				auto s = p->link(-d);
+				if (s->balance == 0) {
+					_stats.rotation(false);
+					rotate(p, -d);
+					p->balance = -d;
+					s->balance = d;
+					return s;
+				}
+				if (s->balance == -d) {
+					_stats.rotation(false);
+					top = rotate(p, -d);
+					p->balance = 0;
+					s->balance = 0;
 				} else {
-					//  update node's value
-					cur->key = v;
-					return;
+					auto newr = s->link(d);
+					_stats.rotation(true);
+					rotate(s, d);
+					top = rotate(p, -d);
+					s->balance = newr->balance == d ? -d : 0;
+					p->balance = newr->balance == -d ? d : 0;
+					newr->balance = 0;
 				}
 			}
+			auto parent = top->parent;
+			if (parent == nullptr)
+				return top;
+			d = parent->left == top ? LH : RH;
+			p = parent;
 		}
+	}
 
-		auto& childptr = goLeft ? parent->left : parent->right;
-		childptr = new avl_node<T>(parent, v);
-		++_size;
-		// adjust balance
-		goLeft = (_comp(v, rebalance->key));
-		balance_type a = goLeft ? LH : RH; // left heavy or right heavy
-		auto r = goLeft ? rebalance->left : rebalance->right; // child of rebalance node
-		auto p = r; // runner
-		while (p != childptr) {
-			assert(p->balance == 0);
-			goLeft = (_comp(v, p->key));
-			p->balance = goLeft ? LH : RH;
-			p = goLeft ? p->left : p->right;
-		}
-
-		if (rebalance->balance == 0) {
-			rebalance->balance = a; // todo: +1 level here
-			return;
+	// Checks links and balance of n, trusting the balances below its children.
+	template<typename T, typename Comp, typename Policy>
+	int avl_tree<T, Comp, Policy>::check_node(const node_type* n) const {
+		if (n == nullptr)
+			return 0;
+		if ((n->left && n->left->parent != n) || (n->right && n->right->parent != n))
+			throw std::logic_error("avl_tree: broken parent link");
+		int lh = avl_height(n->left);
+		int rh = avl_height(n->right);
+		if (rh - lh != n->balance)
+			throw std::logic_error("avl_tree: balance does not match child heights");
+		return 1 + std::max(lh, rh);
+	}
+
+	template<typename T, typename Comp, typename Policy>
+	void avl_tree<T, Comp, Policy>::check_order(const node_type* n) const {
+		auto prev = avl_prev(n);
+		auto next = avl_next(n);
+		auto cmp = [this](const T& a, const T& b) {
+			return is_three_way<Comp>::value ? _comp(a, b) : (_comp(a, b) ? -1 : 0);
+		};
+		if ((prev && cmp(prev->key, n->key) >= 0) || (next && cmp(n->key, next->key) >= 0))
+			throw std::logic_error("avl_tree: key out of order");
+	}
+
+	// Validates every node from lowest up to top together with their children.
+	// Nodes above top kept their balances and subtree heights, so only the
+	// path is walked. The height of the child on the path is carried up;
+	// the other child's height is walked down again, which is O(i) at i
+	// levels above a leaf. That makes O(k^2) for k levels, O(log^2 n) in the
+	// worst case, instead of O(n).
+	template<typename T, typename Comp, typename Policy>
+	void avl_tree<T, Comp, Policy>::check_path(const node_type* lowest, const node_type* top) const {
+		int lh = check_node(lowest->left);
+		int rh = check_node(lowest->right);
+		for (auto n = lowest; ; ) {
+			if ((n->left && n->left->parent != n) || (n->right && n->right->parent != n))
+				throw std::logic_error("avl_tree: broken parent link");
+			if (rh - lh != n->balance)
+				throw std::logic_error("avl_tree: balance does not match child heights");
+			const int h = 1 + std::max(lh, rh);
+			if (n == top)
+				break;
+			auto child = n;
+			n = n->parent;
+			if (n->left == child) {
+				lh = h;
+				rh = check_node(n->right);
+			} else if (n->right == child) {
+				lh = check_node(n->left);
+				rh = h;
+			} else {
+				throw std::logic_error("avl_tree: broken parent link");
+			}
 		}
+		if (top->parent ? (top->parent->left != top && top->parent->right != top) : _root != top)
+			throw std::logic_error("avl_tree: broken parent link");
+	}
 
-		if (rebalance->balance == -a) {
-			rebalance->balance = 0; // got more balance
-			return;
+	template<typename T, typename Comp, typename Policy>
+	typename avl_tree<T, Comp, Policy>::node_ptr avl_tree<T, Comp, Policy>::insert_existing(node_ptr n, const T& v) {
+		if (is_dead(n)) {
+			// Revived in place, as its single occurrence in multi mode. A
+			// rebuild while it was dead dropped it from the filter.
+			set_dead(n, false, std::integral_constant<bool, Policy::lazy>());
+			n->key = v;
+			--_dead;
+			++_distinct;
+			++_size;
+			_filter.add(v);
+			refresh_filter();
+			return n;
 		}
+		if (add_duplicate(n, std::integral_constant<bool, Policy::multi>()))
+			++_size;
+		else
+			n->key = v; //  update node's value
+		return n;
+	}
 
-		bool change_root = rebalance->parent == nullptr;
-		avl_node<T>* stub = nullptr;
-		auto& parent_link = rebalance->parent
-				? ((rebalance->parent->left == rebalance)
-					 ? rebalance->parent->left
-					 : rebalance->parent->right)
-				: stub;
-		auto parent_ptr = rebalance->parent;
-		if (r->balance == a) {
-			// single rotation
-			rebalance->link(a) = r->link(-a);
-			assignParent(rebalance->link(a), rebalance);
-			r->link(-a) = rebalance;
-			rebalance->parent = r;
-
-			rebalance->balance = 0;
-			r->balance = 0;
-
-			parent_link = r;
-			r->parent = parent_ptr;
-			if (change_root)
-				_root = r;
-			return;
+	template<typename T, typename Comp, typename Policy>
+	const typename avl_tree<T, Comp, Policy>::node_type* avl_tree<T, Comp, Policy>::insert(const node_type* hint, const T& v) {
+		if (_root == nullptr) {
+			_root = _leftmost = _rightmost = make_node(nullptr, v);
+			_size = 1;
+			_distinct = 1;
+			_stats.insert(0);
+			refresh_filter();
+			if (Policy::checked)
+				check_path(_root, _root);
+			return _root;
 		}
 
-		if (r->balance == -a) {
+		const extra_type probe(v);
+		size_type visits = 0;
+		node_ptr parent = nullptr;
+		node_ptr cur = _root;
+		balance_type a = LH;
+		if (hint != nullptr) {
+			// Climb from the finger to the nearest ancestor that bounds v on the
+			// far side; v then belongs under start, on its a side. Ancestors
+			// reached from the a side lie behind the finger and need no compare.
+			node_ptr start = const_cast<node_ptr>(hint);
+			++visits;
+			int c = compare(v, probe, start);
+			if (c == 0) {
+				_stats.insert(visits);
+				return insert_existing(start, v);
+			}
+			a = c < 0 ? LH : RH;
+			// Nothing lies beyond the extreme nodes: skip the climb.
+			if (!(start == _rightmost && a == RH) && !(start == _leftmost && a == LH)) {
+				for (auto child = start; child->parent != nullptr; child = child->parent) {
+					auto p = child->parent;
+					++visits;
+					if (p->link(-a) != child)
+						continue;
+					c = compare(v, probe, p);
+					if (c == 0) {
+						_stats.insert(visits);
+						return insert_existing(p, v);
+					}
+					if ((c < 0 ? LH : RH) != a)
+						break;
+					start = p;
+				}
+			}
+			parent = start;
+			cur = start->link(a);
+		}
+		while (cur) {
+			++visits;
+			parent = cur;
+			int c = compare(v, probe, cur);
+			if (c == 0) {
+				_stats.insert(visits);
+				return insert_existing(cur, v);
+			}
+			a = c < 0 ? LH : RH;
+			cur = cur->link(a);
+		}
+		_stats.insert(visits);
+
+		const node_ptr added = parent->link(a) = make_node(parent, v);
+		++_size;
+		++_distinct;
+		if (parent == _leftmost && a == LH)
+			_leftmost = added;
+		else if (parent == _rightmost && a == RH)
+			_rightmost = added;
+
+		if (Policy::checked)
+			check_order(added);
+		auto top = insert_fixup(added);
+		refresh_filter();
+		if (Policy::checked)
+			check_path(added, top);
+		return added;
+	}
+
+	// Retraces from n, whose subtree just grew by one level. Returns the
+	// topmost node whose balance or links were changed.
+	template<typename T, typename Comp, typename Policy>
+	typename avl_tree<T, Comp, Policy>::node_ptr avl_tree<T, Comp, Policy>::insert_fixup(node_ptr n) {
+		for (auto p = n->parent; p != nullptr; n = p, p = n->parent) {
+			balance_type a = p->left == n ? LH : RH;
+			if (p->balance == 0) {
+				p->balance = a; // taller, keep going up
+				continue;
+			}
+			if (p->balance == -a) {
+				p->balance = 0; // got more balance
+				return p;
+			}
+			if (n->balance == a) {
+				// single rotation
+				_stats.rotation(false);
+				rotate(p, a);
+				p->balance = 0;
+				n->balance = 0;
+				return n;
+			}
 			// double rotation
-			auto newr = r->link(-a);
-			r->link(-a) = newr->link(a);
-			assignParent(r->link(-a), r);
-			rebalance->link(a) = newr->link(-a);
-			assignParent(rebalance->link(a), rebalance);
-			newr->link(a) = r;
-			assignParent(newr->link(a), newr);
-			newr->link(-a) = rebalance;
-			assignParent(newr->link(-a), newr);
-
-			r->balance = newr->balance == -a ? a : 0;
-			rebalance->balance = newr->balance == a ? -a : 0;
+			_stats.rotation(true);
+			auto newr = n->link(-a);
+			rotate(n, -a);
+			rotate(p, a);
+			n->balance = newr->balance == -a ? a : 0;
+			p->balance = newr->balance == a ? -a : 0;
 			newr->balance = 0;
-
-			parent_link = newr;
-			newr->parent = parent_ptr;
-			if (change_root)
-				_root = newr;
-			return;
+			return newr;
 		}
-
+		return n;
 	}
 
-	template<typename T, typename Comp>
-	void avl_tree<T, Comp>::erase(const T& key) {
+	template<typename T, typename Comp, typename Policy>
+	void avl_tree<T, Comp, Policy>::erase(const T& key) {
 		if (_root == nullptr)
 			return;
 
 		auto cur = _root;
+		size_type visits = 0;
+		const extra_type probe(key);
 		while (cur != nullptr)
 		{
-			bool goLeft = _comp(key, cur->key);
-			if (goLeft)
+			++visits;
+			int c = compare(key, probe, cur);
+			if (c < 0)
 				cur = cur->left;
+			else if (c > 0)
+				cur = cur->right;
 			else
-			{
-				bool goRight = _comp(cur->key, key);
-				if (goRight)
-					cur = cur->right;
-				else
-					break;
-			}
-
+				break;
 		}
-		if (!cur)
+		_stats.erase(visits);
+		if (!cur || is_dead(cur))
 			return; // nothing to erase here.
+		if (!Policy::lazy || cur == _leftmost || cur == _rightmost) {
+			erase_node(cur);
+			purge_extremes();
+			return;
+		}
+		if (remove_duplicate(cur, std::integral_constant<bool, Policy::multi>())) {
+			--_size;
+			return;
+		}
+		set_dead(cur, true, std::integral_constant<bool, Policy::lazy>());
+		--_size;
+		--_distinct;
+		++_dead;
+		if (_dead * 100 > (_distinct + _dead) * Policy::dead_percent)
+			compact();
+	}
+
+	template<typename T, typename Comp, typename Policy>
+	void avl_tree<T, Comp, Policy>::erase_node(node_ptr cur) {
+		if (remove_duplicate(cur, std::integral_constant<bool, Policy::multi>()))
+		{
+			--_size;
+			return;
+		}
+
+		if (cur == _leftmost)
+			_leftmost = avl_next(cur);
+		if (cur == _rightmost)
+			_rightmost = avl_prev(cur);
 
-		node_ptr replace = nullptr;
-		if (!cur->left)
-			assignParent(replace = cur->right, cur->parent);
-		else if (!cur->right)
-			assignParent(replace = cur->left, cur->parent);
+		node_ptr fix;      // lowest node whose subtree got shorter
+		balance_type side; // ... on this side
+		node_ptr moved = nullptr;
+		if (!cur->left || !cur->right)
+		{
+			fix = cur->parent;
+			side = fix && fix->left == cur ? LH : RH;
+			replace_child(cur, cur->left ? cur->left : cur->right);
+		}
 		else
 		{
 			//replace cur with biggest on the left
 			auto it = cur->left;
 			while (it->right) it = it->right;
-			if (it != cur->left)
+			if (it == cur->left)
 			{
-				assignParent(it->left, it->parent);// ???fix
-				assignParent(cur->left, it);
+				fix = it;
+				side = LH;
+			}
+			else
+			{
+				fix = it->parent;
+				side = RH;
+				fix->right = it->left;
+				assignParent(it->left, fix);
 				it->left = cur->left;
+				it->left->parent = it;
 			}
-			assignParent(cur->right, it);
 			it->right = cur->right;
-			assignParent(it, cur->parent);// should be the last one (to handle the case when it->parent is cur)
-			// todo: dry below
-			avl_node<T>* stub = nullptr;
-			auto& parent_link = cur->parent
-					? ((cur->parent->left == cur)
-						 ? cur->parent->left
-						 : cur->parent->right)
-					: stub;
-			parent_link = it;
-			replace = it;
-		}
-		if (_root == cur)
-			_root = replace;
+			it->right->parent = it;
+			it->balance = cur->balance;
+			replace_child(cur, it);
+			moved = it;
+		}
 
-		--_size;
-		delete cur;
+		if (is_dead(cur)) {
+			--_dead;
+		} else {
+			--_size;
+			--_distinct;
+		}
+		free_node(cur);
+
+		if (fix == nullptr)
+		{
+			refresh_filter();
+			if (Policy::checked && _root)
+				check_path(_root, _root);
+			return;
+		}
+		auto top = erase_fixup(fix, side);
+		refresh_filter();
+		if (Policy::checked)
+		{
+			if (moved)
+				check_order(moved);
+			check_path(fix, top);
+		}
+	}
+
+	template<typename T, typename Comp, typename Policy>
+	const typename avl_tree<T, Comp, Policy>::node_type* avl_tree<T, Comp, Policy>::find(const T& key) const {
+		if (!filter_passes(key)) {
+			_stats.lookup(0);
+			return nullptr;
+		}
+		auto cur = _root;
+		size_type visits = 0;
+		const extra_type probe(key);
+		while (cur != nullptr) {
+			++visits;
+			int c = compare(key, probe, cur);
+			if (c < 0)
+				cur = cur->left;
+			else if (c > 0)
+				cur = cur->right;
+			else
+				break;
+		}
+		_stats.lookup(visits);
+		if (cur != nullptr && is_dead(cur))
+			cur = nullptr;
+		if (cur == nullptr)
+			_filter.false_positive();
+		return cur;
+	}
+
+	template<typename T, typename Comp, typename Policy>
+	void avl_tree<T, Comp, Policy>::find_batch(const T* keys, size_type n, const node_type** out) const {
+		// A slot follows one key down the tree; a finished slot takes the next
+		// key. The key's node extra is built once when the slot is loaded, not
+		// at every step. Node extras have no default constructor, so the slots
+		// start as raw storage and take() constructs them.
+		struct slot
+		{
+			size_type index;
+			const node_type* cur;
+			size_type visits;
+			extra_type probe;
+		};
+		static_assert(std::is_trivially_destructible<extra_type>::value, "find_batch reuses slots without destroying them");
+		alignas(slot) unsigned char storage[sizeof(slot) * batch_width];
+		slot* const slots = reinterpret_cast<slot*>(storage);
+		size_type active = 0, next = 0;
+		// Starts s on the next key the filter lets through.
+		auto take = [&](slot& s) {
+			while (next < n) {
+				const size_type index = next++;
+				if (filter_passes(keys[index])) {
+					new (&s) slot{index, _root, 0, extra_type(keys[index])};
+					avl_prefetch(_root);
+					return true;
+				}
+				out[index] = nullptr;
+				_stats.lookup(0);
+			}
+			return false;
+		};
+		while (active < batch_width && take(slots[active]))
+			++active;
+		while (active != 0) {
+			for (size_type i = 0; i < active; ) {
+				slot& s = slots[i];
+				const T& key = keys[s.index];
+				int c = 0;
+				if (s.cur != nullptr) {
+					++s.visits;
+					c = compare(key, s.probe, s.cur);
+					if (c != 0) {
+						s.cur = c < 0 ? s.cur->left : s.cur->right;
+						if (s.cur != nullptr) {
+							avl_prefetch(s.cur);
+							++i;
+							continue;
+						}
+					}
+				}
+				if (s.cur != nullptr && is_dead(s.cur))
+					s.cur = nullptr;
+				out[s.index] = s.cur;
+				_stats.lookup(s.visits);
+				if (s.cur == nullptr)
+					_filter.false_positive();
+				if (take(s))
+					++i;
+				else
+					s = slots[--active];
+			}
+		}
+	}
+
+	template<typename T, typename Comp, typename Policy>
+	typename avl_tree<T, Comp, Policy>::size_type avl_tree<T, Comp, Policy>::contains_batch(const T* keys, size_type n, bool* out) const {
+		// Chunks of several batch widths keep the pipeline full between refills.
+		const size_type chunk = 8 * batch_width;
+		const node_type* found[chunk];
+		size_type hits = 0;
+		for (size_type at = 0; at < n; at += chunk) {
+			const size_type m = n - at < chunk ? n - at : chunk;
+			find_batch(keys + at, m, found);
+			for (size_type i = 0; i < m; ++i) {
+				out[at + i] = found[i] != nullptr;
+				hits += out[at + i];
+			}
+		}
+		return hits;
+	}
+
+	template<typename T, typename Comp, typename Policy>
+	avl_tree<T, Comp, Policy>::avl_tree(const avl_tree& other)
+		: _comp(other._comp), _root(nullptr), _leftmost(nullptr), _rightmost(nullptr), _size(other._size), _distinct(other._distinct), _filter(other._filter), _dead(other._dead) {
+		if (other._root == nullptr)
+			return;
+		// Preorder walk over parent links, source and copy in step. A child
+		// still missing in the copy is the next one to visit.
+		const node_type* src = other._root;
+		node_ptr dst = _root = clone_node(src, nullptr);
+		try {
+			for (;;) {
+				if (src == other._leftmost)
+					_leftmost = dst;
+				if (src == other._rightmost)
+					_rightmost = dst;
+				if (src->left != nullptr && dst->left == nullptr) {
+					dst->left = clone_node(src->left, dst);
+					src = src->left;
+					dst = dst->left;
+				}
+				else if (src->right != nullptr && dst->right == nullptr) {
+					dst->right = clone_node(src->right, dst);
+					src = src->right;
+					dst = dst->right;
+				}
+				else if (src == other._root) {
+					break;
+				}
+				else {
+					src = src->parent;
+					dst = dst->parent;
+				}
+			}
+		}
+		catch (...) {
+			clear();
+			throw;
+		}
+	}
+
+	template<typename T, typename Comp, typename Policy>
+	void avl_tree<T, Comp, Policy>::clear() {
+		// Descend to a leaf, free it, step back up to its parent.
+		node_ptr n = _root;
+		while (n != nullptr) {
+			if (n->left != nullptr) {
+				n = n->left;
+			}
+			else if (n->right != nullptr) {
+				n = n->right;
+			}
+			else {
+				node_ptr p = n->parent;
+				if (p != nullptr)
+					(p->left == n ? p->left : p->right) = nullptr;
+				free_node(n);
+				n = p;
+			}
+		}
+		_root = _leftmost = _rightmost = nullptr;
+		_size = _distinct = _dead = 0;
+		_filter.clear();
+	}
+
+	template<typename T, typename Comp, typename Policy>
+	void swap(avl_tree<T, Comp, Policy>& a, avl_tree<T, Comp, Policy>& b) noexcept {
+		a.swap(b);
+	}
+
+	template<typename T, typename Comp, typename Policy>
+	void avl_tree<T, Comp, Policy>::compact() {
+		if (_dead == 0)
+			return;
+		// Collect first: avl_next climbs through nodes that are freed below.
+		std::vector<node_ptr> nodes;
+		nodes.reserve(_distinct + _dead);
+		for (node_ptr n = _leftmost; n != nullptr; n = avl_next(n))
+			nodes.push_back(n);
+		size_type live = 0;
+		for (node_ptr n : nodes) {
+			if (is_dead(n))
+				free_node(n);
+			else
+				nodes[live++] = n;
+		}
+		_dead = 0;
+		_root = build_balanced(nodes.data(), live, nullptr);
+		_leftmost = live ? nodes[0] : nullptr;
+		_rightmost = live ? nodes[live - 1] : nullptr;
+		refresh_filter();
+		if (Policy::checked) {
+			for (size_type i = 0; i < live; ++i)
+				check_node(nodes[i]);
+		}
+	}
 
+	// Middle node on top: the left half gets n/2 nodes, the right half the
+	// n-n/2-1 left over, so the left is never the smaller one. Both heights
+	// follow from the sizes alone and every balance is 0 or LH.
+	template<typename T, typename Comp, typename Policy>
+	typename avl_tree<T, Comp, Policy>::node_ptr avl_tree<T, Comp, Policy>::build_balanced(node_ptr* nodes, size_type n, node_ptr parent) {
+		if (n == 0)
+			return nullptr;
+		auto height = [](size_type k) {
+			int h = 0;
+			for (; k != 0; k >>= 1)
+				++h;
+			return h;
+		};
+		const size_type mid = n / 2;
+		node_ptr root = nodes[mid];
+		root->parent = parent;
+		root->left = build_balanced(nodes, mid, root);
+		root->right = build_balanced(nodes + mid + 1, n - mid - 1, root);
+		root->balance = static_cast<balance_type>(height(n - mid - 1) - height(mid));
+		return root;
 	}
 
 }
@@ -0,0 +1,607 @@
+#pragma once
+
+#ifndef TC_BTREE_H
+#define TC_BTREE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace tc
+{
+
+	// Number of keys in keys[0, n) ordered before v (lower_bound) or, with
+	// upper = true, not ordered after v (upper_bound). Branchless binary
+	// search: the loop runs log2(n) times whatever the keys.
+	template<typename T, typename Comp>
+	std::size_t btree_rank(const Comp& comp, const T* keys, std::size_t n, const T& v, bool upper, std::false_type)
+	{
+		if (n == 0)
+			return 0;
+		const T* base = keys;
+		while (n > 1) {
+			std::size_t half = n / 2;
+			base = (upper ? !comp(v, base[half - 1]) : comp(base[half - 1], v)) ? base + half : base;
+			n -= half;
+		}
+		return (base - keys) + (upper ? !comp(v, *base) : comp(*base, v));
+	}
+
+	// Arithmetic keys under std::less: branchless halving down to a window of
+	// 32 keys, then every key of the window is tested and the results summed,
+	// which vectorizes.
+	template<typename T, typename Comp>
+	std::size_t btree_rank(const Comp&, const T* keys, std::size_t n, const T& v, bool upper, std::true_type)
+	{
+		const T* base = keys;
+		while (n > 32) {
+			std::size_t half = n / 2;
+			base = (upper ? base[half - 1] <= v : base[half - 1] < v) ? base + half : base;
+			n -= half;
+		}
+		std::size_t r = base - keys;
+		if (upper) {
+			for (std::size_t i = 0; i < n; ++i)
+				r += base[i] <= v;
+		} else {
+			for (std::size_t i = 0; i < n; ++i)
+				r += base[i] < v;
+		}
+		return r;
+	}
+
+	// B+ tree: all keys live in leaves chained left to right, inner nodes hold
+	// separators only. A node occupies about NodeBytes, so one lookup touches
+	// log_B(n) wide nodes instead of log2(n) binary ones. Keys must be default
+	// constructible and assignable.
+	template<typename T, typename Comp = std::less<T>, std::size_t NodeBytes = 256>
+	class btree
+	{
+	public:
+		using size_type = std::size_t;
+		using value_type = T;
+
+		// Keys per node that fit in NodeBytes next to the header and links.
+		static const size_type leaf_capacity = std::max<size_type>(3,
+			(NodeBytes - 2 * sizeof(void*)) / sizeof(T));
+		static const size_type inner_capacity = std::max<size_type>(3,
+			(NodeBytes - 2 * sizeof(void*)) / (sizeof(T) + sizeof(void*)));
+
+	private:
+		struct node
+		{
+			std::uint32_t count;
+			bool leaf;
+		};
+
+		// Every node has one spare slot so that an insert can overflow it
+		// before it is split.
+		struct leaf_node : node
+		{
+			leaf_node* next;
+			T keys[leaf_capacity + 1];
+		};
+
+		struct inner_node : node
+		{
+			// children[i] holds keys in [keys[i - 1], keys[i]).
+			T keys[inner_capacity + 1];
+			node* children[inner_capacity + 2];
+		};
+
+		static const size_type leaf_min = leaf_capacity / 2;
+		static const size_type inner_min = inner_capacity / 2;
+
+	public:
+		class const_iterator
+		{
+		public:
+			using iterator_category = std::forward_iterator_tag;
+			using value_type = T;
+			using difference_type = std::ptrdiff_t;
+			using pointer = const T*;
+			using reference = const T&;
+
+			const_iterator() : _leaf(nullptr), _pos(0)
+			{ }
+
+			reference operator*() const
+			{ return _leaf->keys[_pos]; }
+
+			pointer operator->() const
+			{ return &_leaf->keys[_pos]; }
+
+			const_iterator& operator++()
+			{
+				if (++_pos == _leaf->count) {
+					_leaf = _leaf->next;
+					_pos = 0;
+				}
+				return *this;
+			}
+
+			const_iterator operator++(int)
+			{
+				auto r = *this;
+				++*this;
+				return r;
+			}
+
+			bool operator==(const const_iterator& o) const
+			{ return _leaf == o._leaf && _pos == o._pos; }
+
+			bool operator!=(const const_iterator& o) const
+			{ return !(*this == o); }
+
+		private:
+			friend class btree;
+			const_iterator(const leaf_node* leaf, size_type pos) : _leaf(leaf), _pos(pos)
+			{ }
+
+			const leaf_node* _leaf;
+			size_type _pos;
+		};
+
+		btree() : _root(nullptr), _first(nullptr), _size(0u), _height(0u)
+		{ }
+
+		// Bulk load from an ascending range; of equivalent keys the last wins,
+		// as with repeated insert. Nodes are filled evenly in O(n).
+		template<typename It>
+		btree(It first, It last, const Comp& comp = Comp())
+			: _comp(comp), _root(nullptr), _first(nullptr), _size(0u), _height(0u)
+		{ bulk_load(first, last); }
+
+		btree(btree&& other) noexcept
+			: _comp(other._comp), _root(other._root), _first(other._first), _size(other._size), _height(other._height)
+		{
+			other._root = nullptr;
+			other._first = nullptr;
+			other._size = 0;
+			other._height = 0;
+		}
+
+		btree& operator=(btree&& other) noexcept
+		{
+			std::swap(_comp, other._comp);
+			std::swap(_root, other._root);
+			std::swap(_first, other._first);
+			std::swap(_size, other._size);
+			std::swap(_height, other._height);
+			return *this;
+		}
+
+		btree(const btree&) = delete;
+		btree& operator=(const btree&) = delete;
+
+		~btree()
+		{ clear(); }
+
+		size_type size() const
+		{ return _size; }
+
+		bool empty() const
+		{ return _size == 0; }
+
+		// Number of node levels, 0 for an empty tree.
+		size_type height() const
+		{ return _height; }
+
+		const_iterator begin() const
+		{ return const_iterator(_size ? _first : nullptr, 0); }
+
+		const_iterator end() const
+		{ return const_iterator(); }
+
+		// Inserts value or, if an equivalent key exists, overwrites it.
+		void insert(const T& value);
+
+		void erase(const T& key);
+
+		// Stored key equivalent to key or nullptr.
+		const T* find(const T& key) const;
+
+		bool contains(const T& key) const
+		{ return find(key) != nullptr; }
+
+		void clear()
+		{
+			if (_root)
+				free_subtree(_root);
+			_root = nullptr;
+			_first = nullptr;
+			_size = 0;
+			_height = 0;
+		}
+
+		// Full structural check: ordering, separators, occupancy, equal leaf
+		// depth and the leaf chain. O(n), meant for tests.
+		bool is_valid() const;
+
+	private:
+		using linear_search = std::integral_constant<bool,
+			std::is_arithmetic<T>::value && std::is_same<Comp, std::less<T>>::value>;
+
+		size_type rank(const T* keys, size_type n, const T& v, bool upper) const
+		{ return btree_rank(_comp, keys, n, v, upper, linear_search()); }
+
+		template<typename It>
+		void bulk_load(It first, It last);
+
+		node* insert_rec(node* n, const T& v, T& sep, bool& added);
+		bool erase_rec(node* n, const T& key);
+		void fix_child(inner_node* p, size_type idx);
+		void free_subtree(node* n);
+		bool check_rec(const node* n, const T* lo, const T* hi, size_type depth, const leaf_node*& prev_leaf) const;
+
+		template<typename A>
+		static void shift_right(A* a, size_type from, size_type count)
+		{ std::move_backward(a + from, a + count, a + count + 1); }
+
+		template<typename A>
+		static void shift_left(A* a, size_type from, size_type count)
+		{ std::move(a + from + 1, a + count, a + from); }
+
+		Comp _comp;
+		node* _root;
+		leaf_node* _first;
+		size_type _size;
+		size_type _height;
+	};
+
+	template<typename T, typename Comp, std::size_t NodeBytes>
+	const T* btree<T, Comp, NodeBytes>::find(const T& key) const {
+		auto n = _root;
+		if (n == nullptr)
+			return nullptr;
+		while (!n->leaf) {
+			auto in = static_cast<const inner_node*>(n);
+			n = in->children[rank(in->keys, in->count, key, true)];
+		}
+		auto leaf = static_cast<const leaf_node*>(n);
+		auto pos = rank(leaf->keys, leaf->count, key, false);
+		if (pos < leaf->count && !_comp(key, leaf->keys[pos]))
+			return &leaf->keys[pos];
+		return nullptr;
+	}
+
+	template<typename T, typename Comp, std::size_t NodeBytes>
+	void btree<T, Comp, NodeBytes>::insert(const T& value) {
+		if (_root == nullptr) {
+			auto leaf = new leaf_node();
+			leaf->leaf = true;
+			leaf->count = 0;
+			leaf->next = nullptr;
+			_root = _first = leaf;
+			_height = 1;
+		}
+		T sep;
+		bool added = false;
+		auto right = insert_rec(_root, value, sep, added);
+		if (added)
+			++_size;
+		if (right) {
+			auto root = new inner_node();
+			root->leaf = false;
+			root->count = 1;
+			root->keys[0] = std::move(sep);
+			root->children[0] = _root;
+			root->children[1] = right;
+			_root = root;
+			++_height;
+		}
+	}
+
+	// Inserts v under n. If n had to split, returns the new right sibling and
+	// stores in sep the smallest key that goes to it.
+	template<typename T, typename Comp, std::size_t NodeBytes>
+	typename btree<T, Comp, NodeBytes>::node* btree<T, Comp, NodeBytes>::insert_rec(node* n, const T& v, T& sep, bool& added) {
+		if (n->leaf) {
+			auto leaf = static_cast<leaf_node*>(n);
+			auto pos = rank(leaf->keys, leaf->count, v, false);
+			if (pos < leaf->count && !_comp(v, leaf->keys[pos])) {
+				leaf->keys[pos] = v;
+				return nullptr;
+			}
+			shift_right(leaf->keys, pos, leaf->count);
+			leaf->keys[pos] = v;
+			++leaf->count;
+			added = true;
+			if (leaf->count <= leaf_capacity)
+				return nullptr;
+
+			auto right = new leaf_node();
+			right->leaf = true;
+			size_type keep = leaf->count / 2;
+			right->count = leaf->count - keep;
+			std::move(leaf->keys + keep, leaf->keys + leaf->count, right->keys);
+			leaf->count = keep;
+			right->next = leaf->next;
+			leaf->next = right;
+			sep = right->keys[0];
+			return right;
+		}
+
+		auto in = static_cast<inner_node*>(n);
+		auto idx = rank(in->keys, in->count, v, true);
+		T child_sep;
+		auto child_right = insert_rec(in->children[idx], v, child_sep, added);
+		if (child_right == nullptr)
+			return nullptr;
+
+		shift_right(in->keys, idx, in->count);
+		shift_right(in->children, idx + 1, in->count + 1);
+		in->keys[idx] = std::move(child_sep);
+		in->children[idx + 1] = child_right;
+		++in->count;
+		if (in->count <= inner_capacity)
+			return nullptr;
+
+		// The middle key moves up, the upper half moves to a new node.
+		auto right = new inner_node();
+		right->leaf = false;
+		size_type keep = in->count / 2;
+		right->count = in->count - keep - 1;
+		sep = std::move(in->keys[keep]);
+		std::move(in->keys + keep + 1, in->keys + in->count, right->keys);
+		std::copy(in->children + keep + 1, in->children + in->count + 1, right->children);
+		in->count = keep;
+		return right;
+	}
+
+	template<typename T, typename Comp, std::size_t NodeBytes>
+	void btree<T, Comp, NodeBytes>::erase(const T& key) {
+		if (_root == nullptr || !erase_rec(_root, key))
+			return;
+		--_size;
+		if (_root->count == 0) {
+			auto old = _root;
+			if (_root->leaf) {
+				_root = nullptr;
+				_first = nullptr;
+			} else {
+				_root = static_cast<inner_node*>(old)->children[0];
+			}
+			--_height;
+			if (old->leaf)
+				delete static_cast<leaf_node*>(old);
+			else
+				delete static_cast<inner_node*>(old);
+		}
+	}
+
+	// Separators equal to an erased key are left in place: they still split
+	// the key space correctly.
+	template<typename T, typename Comp, std::size_t NodeBytes>
+	bool btree<T, Comp, NodeBytes>::erase_rec(node* n, const T& key) {
+		if (n->leaf) {
+			auto leaf = static_cast<leaf_node*>(n);
+			auto pos = rank(leaf->keys, leaf->count, key, false);
+			if (pos == leaf->count || _comp(key, leaf->keys[pos]))
+				return false;
+			shift_left(leaf->keys, pos, leaf->count);
+			--leaf->count;
+			return true;
+		}
+		auto in = static_cast<inner_node*>(n);
+		auto idx = rank(in->keys, in->count, key, true);
+		if (!erase_rec(in->children[idx], key))
+			return false;
+		auto child = in->children[idx];
+		if (child->count < (child->leaf ? leaf_min : inner_min))
+			fix_child(in, idx);
+		return true;
+	}
+
+	// Refills the underfull child p->children[idx] from a sibling, or merges
+	// it with one.
+	template<typename T, typename Comp, std::size_t NodeBytes>
+	void btree<T, Comp, NodeBytes>::fix_child(inner_node* p, size_type idx) {
+		auto child = p->children[idx];
+		auto left = idx > 0 ? p->children[idx - 1] : nullptr;
+		auto right = idx < p->count ? p->children[idx + 1] : nullptr;
+		const size_type min = child->leaf ? leaf_min : inner_min;
+
+		if (child->leaf) {
+			auto c = static_cast<leaf_node*>(child);
+			auto l = static_cast<leaf_node*>(left);
+			auto r = static_cast<leaf_node*>(right);
+			if (l && l->count > min) {
+				shift_right(c->keys, 0, c->count);
+				c->keys[0] = std::move(l->keys[--l->count]);
+				++c->count;
+				p->keys[idx - 1] = c->keys[0];
+				return;
+			}
+			if (r && r->count > min) {
+				c->keys[c->count++] = std::move(r->keys[0]);
+				shift_left(r->keys, 0, r->count--);
+				p->keys[idx] = r->keys[0];
+				return;
+			}
+			if (!l) { // merge the right sibling into c instead
+				l = c;
+				c = r;
+				++idx;
+			}
+			std::move(c->keys, c->keys + c->count, l->keys + l->count);
+			l->count += c->count;
+			l->next = c->next;
+			delete c;
+		} else {
+			auto c = static_cast<inner_node*>(child);
+			auto l = static_cast<inner_node*>(left);
+			auto r = static_cast<inner_node*>(right);
+			if (l && l->count > min) {
+				shift_right(c->keys, 0, c->count);
+				shift_right(c->children, 0, c->count + 1);
+				c->keys[0] = std::move(p->keys[idx - 1]);
+				c->children[0] = l->children[l->count];
+				p->keys[idx - 1] = std::move(l->keys[l->count - 1]);
+				--l->count;
+				++c->count;
+				return;
+			}
+			if (r && r->count > min) {
+				c->keys[c->count] = std::move(p->keys[idx]);
+				c->children[c->count + 1] = r->children[0];
+				++c->count;
+				p->keys[idx] = std::move(r->keys[0]);
+				shift_left(r->keys, 0, r->count);
+				shift_left(r->children, 0, r->count + 1);
+				--r->count;
+				return;
+			}
+			if (!l) {
+				l = c;
+				c = r;
+				++idx;
+			}
+			l->keys[l->count] = std::move(p->keys[idx - 1]);
+			std::move(c->keys, c->keys + c->count, l->keys + l->count + 1);
+			std::copy(c->children, c->children + c->count + 1, l->children + l->count + 1);
+			l->count += c->count + 1;
+			delete c;
+		}
+		// c at idx is gone together with the separator in front of it.
+		shift_left(p->keys, idx - 1, p->count);
+		shift_left(p->children, idx, p->count + 1);
+		--p->count;
+	}
+
+	template<typename T, typename Comp, std::size_t NodeBytes>
+	template<typename It>
+	void btree<T, Comp, NodeBytes>::bulk_load(It first, It last) {
+		std::vector<T> keys;
+		for (; first != last; ++first) {
+			if (!keys.empty() && !_comp(keys.back(), *first))
+				keys.back() = *first;
+			else
+				keys.push_back(*first);
+		}
+		if (keys.empty())
+			return;
+
+		// Items are spread evenly over as few nodes as possible, which keeps
+		// every node but a lone root above the minimum fill.
+		auto spread = [](size_type n, size_type i, size_type parts) {
+			return n * i / parts;
+		};
+
+		std::vector<node*> level;
+		std::vector<T> lows; // smallest key under each node of the level
+		size_type parts = (keys.size() + leaf_capacity - 1) / leaf_capacity;
+		leaf_node* prev = nullptr;
+		for (size_type i = 0; i < parts; ++i) {
+			auto leaf = new leaf_node();
+			leaf->leaf = true;
+			leaf->next = nullptr;
+			auto b = spread(keys.size(), i, parts);
+			auto e = spread(keys.size(), i + 1, parts);
+			leaf->count = e - b;
+			std::move(keys.begin() + b, keys.begin() + e, leaf->keys);
+			lows.push_back(leaf->keys[0]);
+			if (prev)
+				prev->next = leaf;
+			else
+				_first = leaf;
+			prev = leaf;
+			level.push_back(leaf);
+		}
+		_size = keys.size();
+		_height = 1;
+
+		while (level.size() > 1) {
+			std::vector<node*> up;
+			std::vector<T> up_lows;
+			parts = (level.size() + inner_capacity) / (inner_capacity + 1);
+			for (size_type i = 0; i < parts; ++i) {
+				auto in = new inner_node();
+				in->leaf = false;
+				auto b = spread(level.size(), i, parts);
+				auto e = spread(level.size(), i + 1, parts);
+				in->count = e - b - 1;
+				for (auto j = b; j < e; ++j) {
+					in->children[j - b] = level[j];
+					if (j > b)
+						in->keys[j - b - 1] = lows[j];
+				}
+				up.push_back(in);
+				up_lows.push_back(lows[b]);
+			}
+			level.swap(up);
+			lows.swap(up_lows);
+			++_height;
+		}
+		_root = level[0];
+	}
+
+	template<typename T, typename Comp, std::size_t NodeBytes>
+	void btree<T, Comp, NodeBytes>::free_subtree(node* n) {
+		if (n->leaf) {
+			delete static_cast<leaf_node*>(n);
+			return;
+		}
+		auto in = static_cast<inner_node*>(n);
+		for (size_type i = 0; i <= in->count; ++i)
+			free_subtree(in->children[i]);
+		delete in;
+	}
+
+	template<typename T, typename Comp, std::size_t NodeBytes>
+	bool btree<T, Comp, NodeBytes>::is_valid() const {
+		if (_root == nullptr)
+			return _size == 0 && _height == 0 && _first == nullptr;
+		const leaf_node* prev_leaf = nullptr;
+		if (!check_rec(_root, nullptr, nullptr, 1, prev_leaf))
+			return false;
+		if (prev_leaf->next != nullptr)
+			return false;
+		size_type n = 0;
+		for (auto it = begin(); it != end(); ++it)
+			++n;
+		return n == _size;
+	}
+
+	// Keys under n must lie in [lo, hi); leaves must all sit at _height and be
+	// chained in order.
+	template<typename T, typename Comp, std::size_t NodeBytes>
+	bool btree<T, Comp, NodeBytes>::check_rec(const node* n, const T* lo, const T* hi, size_type depth, const leaf_node*& prev_leaf) const {
+		const bool root = n == _root;
+		if (n->leaf) {
+			auto leaf = static_cast<const leaf_node*>(n);
+			if (depth != _height || leaf->count > leaf_capacity || (!root && leaf->count < leaf_min) || leaf->count == 0)
+				return false;
+			if ((prev_leaf ? prev_leaf->next : _first) != leaf)
+				return false;
+			prev_leaf = leaf;
+			for (size_type i = 0; i < leaf->count; ++i) {
+				if (i > 0 && !_comp(leaf->keys[i - 1], leaf->keys[i]))
+					return false;
+				if ((lo && _comp(leaf->keys[i], *lo)) || (hi && !_comp(leaf->keys[i], *hi)))
+					return false;
+			}
+			return true;
+		}
+		auto in = static_cast<const inner_node*>(n);
+		if (in->count > inner_capacity || (!root && in->count < inner_min) || in->count == 0)
+			return false;
+		for (size_type i = 0; i <= in->count; ++i) {
+			if (i > 0 && i < in->count && !_comp(in->keys[i - 1], in->keys[i]))
+				return false;
+			auto clo = i == 0 ? lo : &in->keys[i - 1];
+			auto chi = i == in->count ? hi : &in->keys[i];
+			if (!check_rec(in->children[i], clo, chi, depth + 1, prev_leaf))
+				return false;
+		}
+		return true;
+	}
+
+}
+
+#endif
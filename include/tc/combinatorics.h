@@ -0,0 +1,175 @@
+#ifndef TC_COMBINATORICS_H
+#define TC_COMBINATORICS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
+#include <vector>
+
+namespace tc {
+
+        constexpr std::uint32_t mod_pow(std::uint64_t base, std::uint64_t e, std::uint32_t p) {
+                std::uint64_t r = 1 % p;
+                base %= p;
+                for (; e != 0; e >>= 1) {
+                        if (e & 1u)
+                                r = r * base % p;
+                        base = base * base % p;
+                }
+                return static_cast<std::uint32_t>(r);
+        }
+
+        // Fills n! and 1/n! mod p for n < size; size must not exceed p, so that
+        // every factorial is invertible. One exponentiation, the rest are products.
+        constexpr void fill_factorials(std::uint32_t* fact, std::uint32_t* inv, std::size_t size, std::uint32_t p) {
+                if (size == 0)
+                        return;
+                fact[0] = 1 % p;
+                for (std::size_t i = 1; i < size; ++i)
+                        fact[i] = static_cast<std::uint32_t>(std::uint64_t(fact[i - 1]) * i % p);
+                inv[size - 1] = mod_pow(fact[size - 1], p - 2, p);
+                for (std::size_t i = size - 1; i > 0; --i)
+                        inv[i - 1] = static_cast<std::uint32_t>(std::uint64_t(inv[i]) * i % p);
+        }
+
+        // nCk and nPk on top of a table providing modulo(), size(), factorial()
+        // and inverse_factorial(). Arguments beyond the table go through Lucas'
+        // theorem, which needs the table to cover all residues (size() == p).
+
+        template<typename Table>
+        constexpr std::uint32_t table_nck(const Table& t, std::uint64_t n, std::uint64_t k) {
+                const std::uint32_t p = t.modulo();
+                if (k > n)
+                        return 0;
+                if (n < t.size())
+                        return static_cast<std::uint32_t>(std::uint64_t(t.factorial(n)) * t.inverse_factorial(k) % p * t.inverse_factorial(n - k) % p);
+                if (t.size() < p)
+                        throw std::out_of_range("nck: n is beyond the table and the table does not cover the modulo");
+                std::uint64_t r = 1 % p;
+                while (k != 0) {
+                        const std::uint64_t ni = n % p, ki = k % p;
+                        if (ki > ni)
+                                return 0;
+                        r = r * t.factorial(ni) % p * t.inverse_factorial(ki) % p * t.inverse_factorial(ni - ki) % p;
+                        n /= p;
+                        k /= p;
+                }
+                return static_cast<std::uint32_t>(r);
+        }
+
+        template<typename Table>
+        constexpr std::uint32_t table_npk(const Table& t, std::uint64_t n, std::uint64_t k) {
+                const std::uint32_t p = t.modulo();
+                if (k > n)
+                        return 0;
+                if (n < t.size())
+                        return static_cast<std::uint32_t>(std::uint64_t(t.factorial(n)) * t.inverse_factorial(n - k) % p);
+                // k consecutive factors contain a multiple of p once k >= p.
+                if (k >= p)
+                        return 0;
+                if (k >= t.size())
+                        throw std::out_of_range("npk: k is beyond the table");
+                // nPk = nCk * k!
+                return static_cast<std::uint32_t>(std::uint64_t(table_nck(t, n, k)) * t.factorial(k) % p);
+        }
+
+        // Factorial and inverse factorial tables mod a prime p for 0 <= n < size,
+        // built in O(size). nck() and npk() are O(1) inside the table.
+        class mod_combinatorics {
+        public:
+                typedef std::uint32_t value_type;
+
+                mod_combinatorics(std::uint32_t p, std::size_t size) : p_(p), fact_(size < p ? size : p), inv_(fact_.size()) {
+                        if (p < 2)
+                                throw std::invalid_argument("modulo must be a prime");
+                        fill_factorials(fact_.data(), inv_.data(), fact_.size(), p_);
+                }
+
+                std::uint32_t modulo() const { return p_; }
+                std::size_t size() const { return fact_.size(); }
+
+                std::uint32_t factorial(std::uint64_t n) const {
+                        return fact_[n];
+                }
+
+                std::uint32_t inverse_factorial(std::uint64_t n) const {
+                        return inv_[n];
+                }
+
+                // 1/n mod p for 0 < n < size().
+                std::uint32_t inverse(std::uint64_t n) const {
+                        if (n == 0 || n >= size())
+                                throw std::out_of_range("inverse: n must be in [1, size)");
+                        return static_cast<std::uint32_t>(std::uint64_t(inv_[n]) * fact_[n - 1] % p_);
+                }
+
+                std::uint32_t nck(std::uint64_t n, std::uint64_t k) const {
+                        return table_nck(*this, n, k);
+                }
+
+                std::uint32_t npk(std::uint64_t n, std::uint64_t k) const {
+                        return table_npk(*this, n, k);
+                }
+
+                // C(n, 0), ..., C(n, n) into out.
+                template<typename OutputIt>
+                OutputIt binomial_row(std::uint64_t n, OutputIt out) const {
+                        if (n < size()) {
+                                const std::uint64_t fn = fact_[n];
+                                for (std::uint64_t k = 0; k <= n; ++k)
+                                        *out++ = static_cast<std::uint32_t>(fn * inv_[k] % p_ * inv_[n - k] % p_);
+                                return out;
+                        }
+                        for (std::uint64_t k = 0; k <= n; ++k)
+                                *out++ = nck(n, k);
+                        return out;
+                }
+
+                std::vector<std::uint32_t> binomial_row(std::uint64_t n) const {
+                        std::vector<std::uint32_t> row;
+                        row.reserve(n + 1);
+                        binomial_row(n, std::back_inserter(row));
+                        return row;
+                }
+
+        private:
+                std::uint32_t p_;
+                std::vector<std::uint32_t> fact_;
+                std::vector<std::uint32_t> inv_;
+        };
+
+        // The same tables with the bounds fixed at compile time; usable in
+        // constant expressions, e.g. constexpr static_mod_combinatorics<1000000007, 1000> c{};
+        template<std::uint32_t P, std::size_t N>
+        class static_mod_combinatorics {
+                static_assert(P >= 2, "modulo must be a prime");
+                static_assert(N >= 1 && N <= P, "table size must be in [1, P]");
+        public:
+                typedef std::uint32_t value_type;
+
+                constexpr static_mod_combinatorics() : fact_(), inv_() {
+                        fill_factorials(fact_, inv_, N, P);
+                }
+
+                constexpr std::uint32_t modulo() const { return P; }
+                constexpr std::size_t size() const { return N; }
+                constexpr std::uint32_t factorial(std::uint64_t n) const { return fact_[n]; }
+                constexpr std::uint32_t inverse_factorial(std::uint64_t n) const { return inv_[n]; }
+
+                constexpr std::uint32_t nck(std::uint64_t n, std::uint64_t k) const {
+                        return table_nck(*this, n, k);
+                }
+
+                constexpr std::uint32_t npk(std::uint64_t n, std::uint64_t k) const {
+                        return table_npk(*this, n, k);
+                }
+
+        private:
+                std::uint32_t fact_[N];
+                std::uint32_t inv_[N];
+        };
+
+}
+
+#endif // TC_COMBINATORICS_H
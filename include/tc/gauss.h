@@ -0,0 +1,294 @@
+#ifndef TC_GAUSS_H
+#define TC_GAUSS_H
+
+#include "tc/matrix.h"
+
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace tc {
+
+        // Field operations for elimination over the integers mod a prime p.
+        // Entries are kept in [0, p).
+        template<typename T>
+        struct modular_field {
+                T p;
+
+                T reduce(T x) const {
+                        x %= p;
+                        return x < T() ? x + p : x;
+                }
+                bool is_zero(const T& a) const { return a == T(); }
+                // Any non-zero entry will do as a pivot.
+                bool better_pivot(const T& best, const T& candidate) const { return best == T() && candidate != T(); }
+                T sub(const T& a, const T& b) const { return a >= b ? a - b : a + (p - b); }
+                T mul(const T& a, const T& b) const { return a * b % p; }
+                T neg(const T& a) const { return a == T() ? a : p - a; }
+                T one() const { return static_cast<T>(1); }
+
+                T inv(const T& a) const {
+                        // Extended Euclid; fails only if p is not prime.
+                        T r0 = p, r1 = a, t0 = T(), t1 = one();
+                        while (r1 != T()) {
+                                T q = r0 / r1;
+                                T r2 = r0 - q * r1;
+                                T t2 = sub(t0, mul(q % p, t1));
+                                r0 = r1; r1 = r2;
+                                t0 = t1; t1 = t2;
+                        }
+                        if (r0 != one())
+                                throw std::runtime_error("no inverse, modulo is not prime");
+                        return t0;
+                }
+        };
+
+        // Field operations for floating point with partial pivoting. Entries
+        // no larger than tolerance count as zero.
+        template<typename T>
+        struct real_field {
+                T tolerance;
+
+                T reduce(const T& x) const { return x; }
+                bool is_zero(const T& a) const { return std::abs(a) <= tolerance; }
+                bool better_pivot(const T& best, const T& candidate) const { return std::abs(candidate) > std::abs(best); }
+                T sub(const T& a, const T& b) const { return a - b; }
+                T mul(const T& a, const T& b) const { return a * b; }
+                T neg(const T& a) const { return -a; }
+                T one() const { return static_cast<T>(1); }
+                T inv(const T& a) const { return one() / a; }
+        };
+
+        template<typename T>
+        real_field<T> elimination_field(const Matrix<T>& m, std::true_type) {
+                typedef typename Matrix<T>::size_type st;
+                if (m.modulo() != T())
+                        throw std::runtime_error("floating point matrix with a modulo");
+                T largest = T();
+                for (st i = 0; i < m.rows(); ++i)
+                        for (st j = 0; j < m.cols(); ++j)
+                                largest = std::max(largest, std::abs(m(i, j)));
+                const T n = static_cast<T>(std::max(m.rows(), m.cols()));
+                return real_field<T>{n * std::numeric_limits<T>::epsilon() * largest};
+        }
+
+        template<typename T>
+        modular_field<T> elimination_field(const Matrix<T>& m, std::false_type) {
+                if (!(m.modulo() > static_cast<T>(1)))
+                        throw std::runtime_error("elimination needs a prime modulo or a floating point type");
+                return modular_field<T>{m.modulo()};
+        }
+
+        // Rows [r0, r1) and columns [c0, c1) of m, in place.
+        template<typename T>
+        ConstMatrixView<T> block_view(const Matrix<T>& m, typename Matrix<T>::size_type r0, typename Matrix<T>::size_type r1,
+                        typename Matrix<T>::size_type c0, typename Matrix<T>::size_type c1) {
+                return m.view().block(r0, c0, r1 - r0, c1 - c0);
+        }
+
+        // m[r0 + i][c0 + j] -= d(i, j)
+        template<typename T, typename F>
+        void subtract_block(Matrix<T>& m, typename Matrix<T>::size_type r0, typename Matrix<T>::size_type c0, const Matrix<T>& d, const F& f) {
+                typedef typename Matrix<T>::size_type st;
+                const MatrixView<T> target = m.view().block(r0, c0, d.rows(), d.cols());
+                for (st i = 0; i < d.rows(); ++i) {
+                        T* row = target.row(i);
+                        const T* sub = d.row(i);
+                        for (st j = 0; j < d.cols(); ++j)
+                                row[j] = f.sub(row[j], sub[j]);
+                }
+        }
+
+        // Row echelon factorization P A = L U. lu holds U on and right of the
+        // pivots and the multipliers of L (unit diagonal) below them. Row i of
+        // lu is row perm[i] of A; pivots[i] is the pivot column of row i, for
+        // the first rank() rows.
+        template<typename T>
+        struct lu_decomposition {
+                typedef typename Matrix<T>::size_type size_type;
+
+                Matrix<T> lu;
+                std::vector<size_type> perm;
+                std::vector<size_type> pivots;
+                bool odd; // perm is an odd permutation
+
+                size_type rank() const { return pivots.size(); }
+        };
+
+        // Blocked right-looking elimination: a panel of block columns is
+        // eliminated row by row, the pivot rows right of the panel are solved
+        // against it, and the trailing submatrix gets one product update from
+        // multiply(), the bulk of the O(n^3) work.
+        template<typename T>
+        lu_decomposition<T> lu_decompose(const Matrix<T>& a, typename Matrix<T>::size_type block = 64) {
+                typedef typename Matrix<T>::size_type st;
+                const auto f = elimination_field(a, std::is_floating_point<T>());
+                const st m = a.rows(), n = a.cols();
+                if (block == 0)
+                        block = 1;
+
+                lu_decomposition<T> d{Matrix<T>(a.modulo(), m, n), std::vector<st>(m), std::vector<st>(), false};
+                Matrix<T>& w = d.lu;
+                for (st i = 0; i < m; ++i) {
+                        d.perm[i] = i;
+                        for (st j = 0; j < n; ++j)
+                                w(i, j) = f.reduce(a(i, j));
+                }
+
+                st r = 0;
+                for (st c = 0; c < n && r < m; c += block) {
+                        const st e = std::min(c + block, n);
+                        const st r0 = r, p0 = d.pivots.size();
+
+                        for (st col = c; col < e && r < m; ++col) {
+                                st best = r;
+                                for (st i = r + 1; i < m; ++i) {
+                                        if (f.better_pivot(w(best, col), w(i, col)))
+                                                best = i;
+                                }
+                                if (f.is_zero(w(best, col)))
+                                        continue;
+                                if (best != r) {
+                                        std::swap_ranges(w.row(r), w.row(r) + n, w.row(best));
+                                        std::swap(d.perm[r], d.perm[best]);
+                                        d.odd = !d.odd;
+                                }
+                                const T inv = f.inv(w(r, col));
+                                const T* pivot_row = w.row(r);
+                                for (st i = r + 1; i < m; ++i) {
+                                        T* row = w.row(i);
+                                        const T mult = f.mul(row[col], inv);
+                                        row[col] = mult;
+                                        if (mult == T())
+                                                continue;
+                                        for (st j = col + 1; j < e; ++j)
+                                                row[j] = f.sub(row[j], f.mul(mult, pivot_row[j]));
+                                }
+                                d.pivots.push_back(col);
+                                ++r;
+                        }
+
+                        const st k = r - r0;
+                        if (k == 0 || e == n)
+                                continue;
+                        // U12: the pivot rows right of the panel, solved against L11.
+                        for (st t = 1; t < k; ++t) {
+                                T* row = w.row(r0 + t);
+                                for (st s = 0; s < t; ++s) {
+                                        const T mult = row[d.pivots[p0 + s]];
+                                        if (mult == T())
+                                                continue;
+                                        const T* above = w.row(r0 + s);
+                                        for (st j = e; j < n; ++j)
+                                                row[j] = f.sub(row[j], f.mul(mult, above[j]));
+                                }
+                        }
+                        if (r == m)
+                                continue;
+                        // A22 -= L21 U12; the pivot columns of L21 need not be adjacent.
+                        Matrix<T> l21(a.modulo(), m - r, k);
+                        for (st i = r; i < m; ++i)
+                                for (st s = 0; s < k; ++s)
+                                        l21(i - r, s) = w(i, d.pivots[p0 + s]);
+                        subtract_block(w, r, e, multiply(l21, block_view(w, r0, r, e, n), plus_times<T>()), f);
+                }
+                return d;
+        }
+
+        template<typename T>
+        typename Matrix<T>::size_type rank(const Matrix<T>& a) {
+                return lu_decompose(a).rank();
+        }
+
+        template<typename T>
+        T det(const Matrix<T>& a) {
+                typedef typename Matrix<T>::size_type st;
+                if (a.rows() != a.cols())
+                        throw std::runtime_error("cols != rows");
+                const auto f = elimination_field(a, std::is_floating_point<T>());
+                const auto d = lu_decompose(a);
+                if (d.rank() < a.rows())
+                        return T();
+                T r = f.one();
+                for (st i = 0; i < a.rows(); ++i)
+                        r = f.mul(r, d.lu(i, i));
+                return d.odd ? f.neg(r) : r;
+        }
+
+        // X with A X = B for a non-singular square A, from a decomposition of A.
+        // Both substitutions run in row blocks whose off-diagonal part is one
+        // multiply() each.
+        template<typename T>
+        Matrix<T> lu_solve(const lu_decomposition<T>& d, const Matrix<T>& b, typename Matrix<T>::size_type block = 64) {
+                typedef typename Matrix<T>::size_type st;
+                const Matrix<T>& lu = d.lu;
+                const st n = lu.rows(), k = b.cols();
+                if (lu.cols() != n || b.rows() != n)
+                        throw std::runtime_error("solve needs a square matrix and a right side with as many rows");
+                if (d.rank() < n)
+                        throw std::runtime_error("singular matrix");
+                if (block == 0)
+                        block = 1;
+                const auto f = elimination_field(lu, std::is_floating_point<T>());
+
+                Matrix<T> x(b.modulo(), n, k);
+                for (st i = 0; i < n; ++i)
+                        for (st j = 0; j < k; ++j)
+                                x(i, j) = f.reduce(b(d.perm[i], j));
+
+                // L y = P b
+                for (st i0 = 0; i0 < n; i0 += block) {
+                        const st i1 = std::min(i0 + block, n);
+                        if (i0 > 0)
+                                subtract_block(x, i0, 0, multiply(block_view(lu, i0, i1, 0, i0), block_view(x, 0, i0, 0, k), plus_times<T>()), f);
+                        for (st i = i0 + 1; i < i1; ++i) {
+                                T* row = x.row(i);
+                                for (st s = i0; s < i; ++s) {
+                                        const T mult = lu(i, s);
+                                        const T* above = x.row(s);
+                                        for (st j = 0; j < k; ++j)
+                                                row[j] = f.sub(row[j], f.mul(mult, above[j]));
+                                }
+                        }
+                }
+                // U x = y
+                for (st i1 = n; i1 > 0; ) {
+                        const st i0 = i1 > block ? i1 - block : 0;
+                        if (i1 < n)
+                                subtract_block(x, i0, 0, multiply(block_view(lu, i0, i1, i1, n), block_view(x, i1, n, 0, k), plus_times<T>()), f);
+                        for (st i = i1; i-- > i0; ) {
+                                T* row = x.row(i);
+                                for (st s = i + 1; s < i1; ++s) {
+                                        const T mult = lu(i, s);
+                                        const T* below = x.row(s);
+                                        for (st j = 0; j < k; ++j)
+                                                row[j] = f.sub(row[j], f.mul(mult, below[j]));
+                                }
+                                const T inv = f.inv(lu(i, i));
+                                for (st j = 0; j < k; ++j)
+                                        row[j] = f.mul(row[j], inv);
+                        }
+                        i1 = i0;
+                }
+                return x;
+        }
+
+        // Solves A X = B; throws for a singular A.
+        template<typename T>
+        Matrix<T> solve(const Matrix<T>& a, const Matrix<T>& b) {
+                return lu_solve(lu_decompose(a), b);
+        }
+
+        template<typename T>
+        Matrix<T> inverse(const Matrix<T>& a) {
+                if (a.rows() != a.cols())
+                        throw std::runtime_error("cols != rows");
+                return solve(a, plus_times<T>::identity(a.modulo(), a.rows()));
+        }
+
+}
+
+#endif // TC_GAUSS_H
@@ -3,9 +3,21 @@
 
 #include <vector>
 #include <stdexcept>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <type_traits>
 
 namespace tc {
 
+        template<typename T>
+        class ConstMatrixView;
+
+        template<typename T>
+        class MatrixView;
+
         template<typename T>
         class Matrix {
         public:
@@ -27,6 +39,8 @@ namespace tc {
 
                 Matrix(size_type rows, size_type cols) : rows_(rows), cols_(cols), modulo_(), d_(rows * cols) {	}
                 Matrix(const T& modulo, size_type rows, size_type cols) : rows_(rows), cols_(cols), modulo_(modulo), d_(rows * cols) {	}
+                // Copies the entries seen through a view.
+                explicit Matrix(const ConstMatrixView<T>& v);
 
                 size_type rows() const { return rows_; }
                 size_type cols() const { return cols_; }
@@ -40,73 +54,502 @@ namespace tc {
                         return d_[row * cols_ + col];
                 }
 
-                bool operator==(const Matrix<T>& other) const {
+                // Contiguous storage of one row, for the multiplication kernels.
+                T* row(size_type r) {
+                        return d_.data() + r * cols_;
+                }
+
+                const T* row(size_type r) const {
+                        return d_.data() + r * cols_;
+                }
+
+                MatrixView<T> view();
+                ConstMatrixView<T> view() const;
+
+                // Compares with a matrix or any view of one.
+                bool operator==(const ConstMatrixView<T>& other) const;
+
+                void reset(const T& v) {
+                        d_.assign(d_.size(), v);
+                }
+
+                Matrix<T> identity() const {
+                        if (rows_ != cols_)
+                                throw std::runtime_error("cols != rows");
+                        return identity(modulo_, rows_);
+                }
+
+        };
+
+        // Non-owning window on matrix entries: entry (i, j) is at
+        // data()[i * row_stride() + j * col_stride()]. Submatrices, transposes
+        // and single rows or columns are views of the same storage with other
+        // strides, so blocked algorithms need no copies. A view is valid as
+        // long as the storage it was taken from; it converts implicitly from a
+        // Matrix and from a MatrixView.
+        template<typename T>
+        class ConstMatrixView {
+        public:
+                typedef typename std::vector<T>::size_type size_type;
+                typedef std::ptrdiff_t difference_type;
+        protected:
+                const T* d_;
+                size_type rows_;
+                size_type cols_;
+                difference_type row_stride_;
+                difference_type col_stride_;
+                T modulo_;
+        public:
+                ConstMatrixView(const T* data, size_type rows, size_type cols, difference_type row_stride, difference_type col_stride, const T& modulo = T())
+                        : d_(data), rows_(rows), cols_(cols), row_stride_(row_stride), col_stride_(col_stride), modulo_(modulo) { }
+                ConstMatrixView(const Matrix<T>& m)
+                        : ConstMatrixView(m.row(0), m.rows(), m.cols(), static_cast<difference_type>(m.cols()), 1, m.modulo()) { }
+
+                size_type rows() const { return rows_; }
+                size_type cols() const { return cols_; }
+                const T& modulo() const { return modulo_; }
+                difference_type row_stride() const { return row_stride_; }
+                difference_type col_stride() const { return col_stride_; }
+                const T* data() const { return d_; }
+
+                const T& operator()(size_type row, size_type col) const {
+                        return d_[static_cast<difference_type>(row) * row_stride_ + static_cast<difference_type>(col) * col_stride_];
+                }
+
+                // First entry of a row; the next ones follow col_stride() apart.
+                const T* row(size_type r) const {
+                        return d_ + static_cast<difference_type>(r) * row_stride_;
+                }
+
+                // True if every row is contiguous, as the multiplication kernels want.
+                bool has_contiguous_rows() const { return col_stride_ == 1; }
+
+                // rows x cols entries starting at (row, col).
+                ConstMatrixView block(size_type row, size_type col, size_type rows, size_type cols) const {
+                        if (row + rows > rows_ || col + cols > cols_)
+                                throw std::out_of_range("block outside the matrix");
+                        return ConstMatrixView(rows && cols ? &(*this)(row, col) : d_, rows, cols, row_stride_, col_stride_, modulo_);
+                }
+
+                ConstMatrixView transposed() const {
+                        return ConstMatrixView(d_, cols_, rows_, col_stride_, row_stride_, modulo_);
+                }
+
+                // Row r as a 1 x cols() view, column c as a rows() x 1 view.
+                ConstMatrixView row_slice(size_type r) const { return block(r, 0, 1, cols_); }
+                ConstMatrixView col_slice(size_type c) const { return block(0, c, rows_, 1); }
+
+                bool operator==(const ConstMatrixView& other) const {
                         if (!(rows_ == other.rows_ && cols_ == other.cols_))
                                 return false;
-                        for (size_t i = 0; i < rows_; ++i) {
-                                for (size_t j = 0; j < cols_; ++j) {
+                        for (size_type i = 0; i < rows_; ++i) {
+                                for (size_type j = 0; j < cols_; ++j) {
                                         if ((*this)(i, j) != other(i, j))
                                                 return false;
                                 }
                         }
                         return true;
                 }
+        };
 
-                void reset(const T& v) {
-                        d_.assign(d_.size(), v);
+        // View allowing writes through it. Like a pointer, a const MatrixView
+        // still writes to the entries it sees.
+        template<typename T>
+        class MatrixView : public ConstMatrixView<T> {
+                typedef ConstMatrixView<T> base;
+        public:
+                typedef typename base::size_type size_type;
+                typedef typename base::difference_type difference_type;
+
+                MatrixView(T* data, size_type rows, size_type cols, difference_type row_stride, difference_type col_stride, const T& modulo = T())
+                        : base(data, rows, cols, row_stride, col_stride, modulo) { }
+                MatrixView(Matrix<T>& m) : base(m) { }
+
+                T* data() const { return const_cast<T*>(this->d_); }
+
+                T& operator()(size_type row, size_type col) const {
+                        return const_cast<T&>(base::operator()(row, col));
                 }
 
-                Matrix<T> identity() const {
-                        if (rows_ != cols_)
-                                throw std::runtime_error("cols != rows");
-                        return identity(modulo_, rows_);
+                T* row(size_type r) const {
+                        return const_cast<T*>(base::row(r));
+                }
+
+                MatrixView block(size_type row, size_type col, size_type rows, size_type cols) const {
+                        return MatrixView(base::block(row, col, rows, cols));
+                }
+
+                MatrixView transposed() const { return MatrixView(base::transposed()); }
+                MatrixView row_slice(size_type r) const { return MatrixView(base::row_slice(r)); }
+                MatrixView col_slice(size_type c) const { return MatrixView(base::col_slice(c)); }
+
+                // Copies the entries of a view of the same shape that does not
+                // overlap this one.
+                void assign(const ConstMatrixView<T>& v) const {
+                        if (v.rows() != this->rows_ || v.cols() != this->cols_)
+                                throw std::runtime_error("views differ in shape");
+                        for (size_type i = 0; i < this->rows_; ++i)
+                                for (size_type j = 0; j < this->cols_; ++j)
+                                        (*this)(i, j) = v(i, j);
+                }
+
+                void fill(const T& v) const {
+                        for (size_type i = 0; i < this->rows_; ++i)
+                                for (size_type j = 0; j < this->cols_; ++j)
+                                        (*this)(i, j) = v;
                 }
 
+        private:
+                explicit MatrixView(const base& v) : base(v) { }
         };
 
         template<typename T>
-        std::ostream& operator<<(std::ostream& os, const Matrix<T>& m) {
+        Matrix<T>::Matrix(const ConstMatrixView<T>& v) : rows_(v.rows()), cols_(v.cols()), modulo_(v.modulo()), d_(v.rows() * v.cols()) {
+                for (size_type i = 0; i < rows_; ++i)
+                        for (size_type j = 0; j < cols_; ++j)
+                                (*this)(i, j) = v(i, j);
+        }
+
+        template<typename T>
+        MatrixView<T> Matrix<T>::view() {
+                return MatrixView<T>(*this);
+        }
+
+        template<typename T>
+        ConstMatrixView<T> Matrix<T>::view() const {
+                return ConstMatrixView<T>(*this);
+        }
+
+        template<typename T>
+        bool Matrix<T>::operator==(const ConstMatrixView<T>& other) const {
+                return view() == other;
+        }
+
+        template<typename T>
+        std::ostream& operator<<(std::ostream& os, const ConstMatrixView<T>& m) {
                 for (size_t i = 0; i < m.rows(); ++i) {
                         for (size_t j = 0; j < m.cols(); ++j) {
-                                std::cout << m(i, j) << ", ";
+                                os << m(i, j) << ", ";
                         }
-                        std::cout << std::endl;
+                        os << std::endl;
                 }
                 return os;
         }
 
         template<typename T>
-        Matrix<T> operator*(const Matrix<T>& left, const Matrix<T>& right) {
-                typedef typename Matrix<T>::size_type st;
+        std::ostream& operator<<(std::ostream& os, const Matrix<T>& m) {
+                return os << m.view();
+        }
+
+        // Parameter type taking a Matrix, a MatrixView or a ConstMatrixView
+        // alike, for functions whose T is deduced from another argument.
+        template<typename T>
+        struct const_view_arg {
+                typedef ConstMatrixView<T> type;
+        };
+
+        // Semirings for multiply() and mpow(). Each provides zero() (neutral for
+        // add, absorbing for mul), one() (neutral for mul), add, mul and the
+        // matching multiplicative identity matrix.
+
+        // Ordinary (+, *), reduced by the matrix modulo when it is set.
+        template<typename T>
+        struct plus_times {
+                typedef T value_type;
+                static T zero() { return T(); }
+                static T one() { return static_cast<T>(1); }
+                static T add(const T& a, const T& b) { return a + b; }
+                static T mul(const T& a, const T& b) { return a * b; }
+                static Matrix<T> identity(const T& modulo, typename Matrix<T>::size_type n);
+        };
+
+        // (min, +) over T extended with infinity(): k-step shortest paths.
+        // Finite sums must fit in T.
+        template<typename T>
+        struct min_plus {
+                typedef T value_type;
+                static T infinity() {
+                        return std::numeric_limits<T>::has_infinity ? std::numeric_limits<T>::infinity() : std::numeric_limits<T>::max();
+                }
+                static T zero() { return infinity(); }
+                static T one() { return T(); }
+                static T add(T a, T b) { return b < a ? b : a; }
+                static T mul(const T& a, const T& b) { return a == zero() || b == zero() ? zero() : a + b; }
+                static Matrix<T> identity(const T& modulo, typename Matrix<T>::size_type n);
+        };
+
+        // (max, +) over T extended with -infinity(): k-step longest paths.
+        template<typename T>
+        struct max_plus {
+                typedef T value_type;
+                static T infinity() {
+                        return std::numeric_limits<T>::has_infinity ? -std::numeric_limits<T>::infinity() : std::numeric_limits<T>::lowest();
+                }
+                static T zero() { return infinity(); }
+                static T one() { return T(); }
+                static T add(T a, T b) { return a < b ? b : a; }
+                static T mul(const T& a, const T& b) { return a == zero() || b == zero() ? zero() : a + b; }
+                static Matrix<T> identity(const T& modulo, typename Matrix<T>::size_type n);
+        };
+
+        // (or, and) on 0/1 entries: reachability. Rows are bit-packed while multiplying.
+        template<typename T>
+        struct or_and {
+                typedef T value_type;
+                static T zero() { return T(); }
+                static T one() { return static_cast<T>(1); }
+                static T add(const T& a, const T& b) { return (a != T() || b != T()) ? one() : zero(); }
+                static T mul(const T& a, const T& b) { return (a != T() && b != T()) ? one() : zero(); }
+                static Matrix<T> identity(const T& modulo, typename Matrix<T>::size_type n);
+        };
+
+        template<typename S>
+        Matrix<typename S::value_type> semiring_identity(const typename S::value_type& modulo, typename Matrix<typename S::value_type>::size_type n) {
+                typedef typename Matrix<typename S::value_type>::size_type st;
+                Matrix<typename S::value_type> id(modulo, n, n);
+                id.reset(S::zero());
+                for (st i = 0; i < n; ++i)
+                        id(i, i) = S::one();
+                return id;
+        }
+
+        template<typename T>
+        Matrix<T> plus_times<T>::identity(const T& modulo, typename Matrix<T>::size_type n) {
+                return semiring_identity<plus_times<T>>(modulo, n);
+        }
+
+        template<typename T>
+        Matrix<T> min_plus<T>::identity(const T& modulo, typename Matrix<T>::size_type n) {
+                return semiring_identity<min_plus<T>>(modulo, n);
+        }
+
+        template<typename T>
+        Matrix<T> max_plus<T>::identity(const T& modulo, typename Matrix<T>::size_type n) {
+                return semiring_identity<max_plus<T>>(modulo, n);
+        }
+
+        template<typename T>
+        Matrix<T> or_and<T>::identity(const T& modulo, typename Matrix<T>::size_type n) {
+                return semiring_identity<or_and<T>>(modulo, n);
+        }
+
+        template<typename T>
+        void check_product(const ConstMatrixView<T>& left, const ConstMatrixView<T>& right) {
                 if (left.cols() != right.rows())
                         throw std::runtime_error("left.cols != right.rows");
                 if (left.modulo() != right.modulo())
                         throw std::runtime_error("left.modulo != right.modulo");
-                bool hasModulo = left.modulo() != T();
-                const T& mod = left.modulo();
-                Matrix<T> r(mod, left.rows(), right.cols());
-                if (hasModulo) {
+        }
+
+        // Kernels run i-k-j: the innermost loop walks one row of right and one row
+        // of the result with a fixed left(i, k), which compilers vectorize. Rows
+        // where left(i, k) is the semiring zero are skipped. Any view works as
+        // left; a right view with strided rows is packed first, O(n^2) against
+        // the O(n^3) product.
+        template<typename T>
+        ConstMatrixView<T> packed_rows(const ConstMatrixView<T>& m, Matrix<T>& storage) {
+                if (m.has_contiguous_rows())
+                        return m;
+                storage = Matrix<T>(m);
+                return storage.view();
+        }
+
+        // How many products of entries in [0, mod) can be added to a value in
+        // [0, mod) before T overflows; 0 if not a single one.
+        template<typename T>
+        T unreduced_terms(const T& mod) {
+                const T top = mod - 1;
+                if (top <= T() || top > std::numeric_limits<T>::max() / top)
+                        return T();
+                return (std::numeric_limits<T>::max() - top) / (top * top);
+        }
+
+        template<typename T>
+        bool is_reduced(const ConstMatrixView<T>& m) {
+                typedef typename Matrix<T>::size_type st;
+                for (st i = 0; i < m.rows(); ++i) {
+                        for (st j = 0; j < m.cols(); ++j) {
+                                if (m(i, j) < T() || !(m(i, j) < m.modulo()))
+                                        return false;
+                        }
+                }
+                return true;
+        }
+
+        template<typename T>
+        bool is_reduced(const Matrix<T>& m) {
+                return is_reduced(m.view());
+        }
+
+        // right has contiguous rows.
+        template<typename T>
+        void multiply_modulo(const ConstMatrixView<T>& left, const ConstMatrixView<T>& right, Matrix<T>& r, std::true_type) {
+                typedef typename Matrix<T>::size_type st;
+                const T mod = left.modulo();
+                const st n = right.cols();
+                const T lazy = unreduced_terms(mod);
+                if (lazy >= 2 && is_reduced(left) && is_reduced(right)) {
+                        // Plain multiply-adds, reduced only every lazy terms: for
+                        // mod = 1e9+7 that is every 9th term in a signed 64-bit T,
+                        // every 18th in an unsigned one.
                         for (st i = 0; i < left.rows(); ++i) {
-                                for (st j = 0; j < right.cols(); ++j) {
-                                        for (st k = 0; k < left.cols(); ++k) {
-                                                r(i, j) = (r(i, j) + (left(i, k) * right(k, j)) % mod) % mod;
+                                T* out = r.row(i);
+                                T pending = T();
+                                for (st k = 0; k < left.cols(); ++k) {
+                                        const T a = left(i, k);
+                                        if (a == T())
+                                                continue;
+                                        const T* b = right.row(k);
+                                        for (st j = 0; j < n; ++j)
+                                                out[j] += a * b[j];
+                                        if (++pending == lazy) {
+                                                for (st j = 0; j < n; ++j)
+                                                        out[j] %= mod;
+                                                pending = T();
                                         }
                                 }
+                                for (st j = 0; j < n; ++j)
+                                        out[j] %= mod;
                         }
+                        return;
                 }
-                else {
-                        for (st i = 0; i < left.rows(); ++i) {
-                                for (st j = 0; j < right.cols(); ++j) {
-                                        for (st k = 0; k < left.cols(); ++k) {
-                                                r(i, j) += left(i, k) * right(k, j);
-                                        }
+                for (st i = 0; i < left.rows(); ++i) {
+                        T* out = r.row(i);
+                        for (st k = 0; k < left.cols(); ++k) {
+                                const T a = left(i, k);
+                                if (a == T())
+                                        continue;
+                                const T* b = right.row(k);
+                                for (st j = 0; j < n; ++j)
+                                        out[j] = (out[j] + (a * b[j]) % mod) % mod;
+                        }
+                }
+        }
+
+        template<typename T>
+        void multiply_modulo(const ConstMatrixView<T>&, const ConstMatrixView<T>&, Matrix<T>&, std::false_type) {
+                throw std::runtime_error("modulo needs an integral type");
+        }
+
+        template<typename T>
+        Matrix<T> multiply(typename const_view_arg<T>::type left, typename const_view_arg<T>::type right, plus_times<T>) {
+                typedef typename Matrix<T>::size_type st;
+                check_product(left, right);
+                Matrix<T> storage(0, 0);
+                right = packed_rows(right, storage);
+                const T& mod = left.modulo();
+                const st n = right.cols();
+                Matrix<T> r(mod, left.rows(), n);
+                if (mod != T()) {
+                        multiply_modulo(left, right, r, std::is_integral<T>());
+                        return r;
+                }
+                for (st i = 0; i < left.rows(); ++i) {
+                        T* out = r.row(i);
+                        for (st k = 0; k < left.cols(); ++k) {
+                                const T a = left(i, k);
+                                if (a == T())
+                                        continue;
+                                const T* b = right.row(k);
+                                for (st j = 0; j < n; ++j)
+                                        out[j] += a * b[j];
+                        }
+                }
+                return r;
+        }
+
+        template<typename T, typename S>
+        Matrix<T> tropical_multiply(const ConstMatrixView<T>& left, ConstMatrixView<T> right) {
+                typedef typename Matrix<T>::size_type st;
+                check_product(left, right);
+                Matrix<T> storage(0, 0);
+                right = packed_rows(right, storage);
+                const T inf = S::zero();
+                const st n = right.cols();
+                Matrix<T> r(left.modulo(), left.rows(), n);
+                r.reset(inf);
+                for (st i = 0; i < left.rows(); ++i) {
+                        T* out = r.row(i);
+                        for (st k = 0; k < left.cols(); ++k) {
+                                const T a = left(i, k);
+                                if (a == inf)
+                                        continue;
+                                const T* b = right.row(k);
+                                // IEEE infinities absorb finite addends by themselves; other
+                                // types select rather than branch so the loop stays vectorizable.
+                                if (std::numeric_limits<T>::has_infinity) {
+                                        for (st j = 0; j < n; ++j)
+                                                out[j] = S::add(out[j], a + b[j]);
+                                }
+                                else {
+                                        for (st j = 0; j < n; ++j)
+                                                out[j] = S::add(out[j], b[j] == inf ? inf : a + b[j]);
                                 }
                         }
                 }
+                return r;
+        }
+
+        template<typename T>
+        Matrix<T> multiply(typename const_view_arg<T>::type left, typename const_view_arg<T>::type right, min_plus<T>) {
+                return tropical_multiply<T, min_plus<T>>(left, right);
+        }
 
+        template<typename T>
+        Matrix<T> multiply(typename const_view_arg<T>::type left, typename const_view_arg<T>::type right, max_plus<T>) {
+                return tropical_multiply<T, max_plus<T>>(left, right);
+        }
+
+        template<typename T>
+        Matrix<T> multiply(typename const_view_arg<T>::type left, typename const_view_arg<T>::type right, or_and<T>) {
+                typedef typename Matrix<T>::size_type st;
+                check_product(left, right);
+                const st n = right.cols();
+                const st words = (n + 63) / 64;
+                // Row k of right as a bit set; row i of the result is the union of
+                // the rows k with left(i, k) set, 64 columns per operation.
+                std::vector<std::uint64_t> bits(right.rows() * words);
+                for (st k = 0; k < right.rows(); ++k) {
+                        for (st j = 0; j < n; ++j) {
+                                if (right(k, j) != T())
+                                        bits[k * words + j / 64] |= std::uint64_t(1) << (j % 64);
+                        }
+                }
+                std::vector<std::uint64_t> acc(words);
+                Matrix<T> r(left.modulo(), left.rows(), n);
+                for (st i = 0; i < left.rows(); ++i) {
+                        std::fill(acc.begin(), acc.end(), 0);
+                        for (st k = 0; k < left.cols(); ++k) {
+                                if (left(i, k) == T())
+                                        continue;
+                                const std::uint64_t* b = bits.data() + k * words;
+                                for (st w = 0; w < words; ++w)
+                                        acc[w] |= b[w];
+                        }
+                        T* out = r.row(i);
+                        for (st j = 0; j < n; ++j)
+                                out[j] = (acc[j / 64] >> (j % 64)) & 1u ? or_and<T>::one() : or_and<T>::zero();
+                }
                 return r;
         }
 
+        template<typename T>
+        Matrix<T> operator*(const Matrix<T>& left, const Matrix<T>& right) {
+                return multiply(left, right, plus_times<T>());
+        }
+
+        // A view on the left takes anything on the right; a Matrix on the left
+        // takes a view.
+        template<typename T>
+        Matrix<T> operator*(const ConstMatrixView<T>& left, typename const_view_arg<T>::type right) {
+                return multiply(left, right, plus_times<T>());
+        }
+
+        template<typename T>
+        Matrix<T> operator*(const Matrix<T>& left, const ConstMatrixView<T>& right) {
+                return multiply(left, right, plus_times<T>());
+        }
+
         template<typename T>
         Matrix<T> mpow_recursive(const Matrix<T>& m, unsigned p) {
                 if (p == 0) {
@@ -122,21 +565,38 @@ namespace tc {
                 return result * result;
         }
 
-        template<typename T>
-        Matrix<T> mpow(const Matrix<T>& m, unsigned p) {
+        template<typename S>
+        Matrix<typename S::value_type> mpow(typename const_view_arg<typename S::value_type>::type m, unsigned p, S semiring) {
+                if (m.rows() != m.cols())
+                        throw std::runtime_error("cols != rows");
                 if (p == 0)
-                        return m.identity();
+                        return S::identity(m.modulo(), m.rows());
 
-                auto result = m;
-                auto mToPower = m;
-                for (unsigned long long power = 2; power <= p; power = power << 1) {
-                        mToPower = mToPower * mToPower;
-                        if ((power & p) != 0)
-                                result = result * mToPower;
+                // Start from the lowest set bit so that no identity product is needed.
+                Matrix<typename S::value_type> mToPower(m);
+                while ((p & 1u) == 0) {
+                        mToPower = multiply(mToPower, mToPower, semiring);
+                        p >>= 1;
+                }
+                auto result = mToPower;
+                for (p >>= 1; p != 0; p >>= 1) {
+                        mToPower = multiply(mToPower, mToPower, semiring);
+                        if ((p & 1u) != 0)
+                                result = multiply(result, mToPower, semiring);
                 }
                 return result;
         }
 
+        template<typename T>
+        Matrix<T> mpow(const Matrix<T>& m, unsigned p) {
+                return mpow(m, p, plus_times<T>());
+        }
+
+        template<typename T>
+        Matrix<T> mpow(const ConstMatrixView<T>& m, unsigned p) {
+                return mpow(m, p, plus_times<T>());
+        }
+
 }
 
 #endif // TC_MATRIX_H
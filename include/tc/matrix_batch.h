@@ -0,0 +1,290 @@
+#ifndef TC_MATRIX_BATCH_H
+#define TC_MATRIX_BATCH_H
+
+#include "tc/matrix.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+namespace tc {
+
+        // Many N x N matrices sharing one modulo, stored so that the same entry
+        // of consecutive matrices is contiguous: matrices are grouped in blocks
+        // of block_size, and a block holds entry (0, 0) of all its matrices,
+        // then entry (0, 1), and so on. Products then run entry by entry with
+        // the batch as the innermost, vectorizable loop, and a block of every
+        // operand stays in L1 for small N. The last block is padded with zero
+        // matrices.
+        template<typename T, std::size_t N>
+        class MatrixBatch {
+                static_assert(N > 0, "empty matrices");
+                // The products keep a block of results on the stack, N * N *
+                // block_size entries: 16 KB of 64-bit entries at N = 8.
+                static_assert(N <= 8, "MatrixBatch is meant for small matrices");
+        public:
+                typedef typename std::vector<T>::size_type size_type;
+                static const size_type block_size = 32;
+                static const size_type block_entries = N * N * block_size;
+        private:
+                size_type size_;
+                T modulo_;
+                std::vector<T> d_;
+        public:
+                explicit MatrixBatch(size_type size) : MatrixBatch(T(), size) { }
+                MatrixBatch(const T& modulo, size_type size)
+                        : size_(size), modulo_(modulo), d_((size + block_size - 1) / block_size * block_entries) { }
+
+                // Number of matrices.
+                size_type size() const { return size_; }
+                size_type blocks() const { return d_.size() / block_entries; }
+                const T& modulo() const { return modulo_; }
+
+                // Entry (row, col) of matrix m.
+                T& operator()(size_type m, size_type row, size_type col) {
+                        return d_[index(m, row, col)];
+                }
+
+                const T& operator()(size_type m, size_type row, size_type col) const {
+                        return d_[index(m, row, col)];
+                }
+
+                // Entry (row, col) of the block_size matrices of one block.
+                T* lane(size_type block, size_type row, size_type col) {
+                        return d_.data() + block * block_entries + (row * N + col) * block_size;
+                }
+
+                const T* lane(size_type block, size_type row, size_type col) const {
+                        return d_.data() + block * block_entries + (row * N + col) * block_size;
+                }
+
+                Matrix<T> get(size_type m) const {
+                        Matrix<T> r(modulo_, N, N);
+                        for (size_type i = 0; i < N; ++i)
+                                for (size_type j = 0; j < N; ++j)
+                                        r(i, j) = (*this)(m, i, j);
+                        return r;
+                }
+
+                void set(size_type m, const Matrix<T>& v) {
+                        if (v.rows() != N || v.cols() != N)
+                                throw std::runtime_error("matrix does not match the batch shape");
+                        for (size_type i = 0; i < N; ++i)
+                                for (size_type j = 0; j < N; ++j)
+                                        (*this)(m, i, j) = v(i, j);
+                }
+
+                // Every matrix, padding included, becomes the identity.
+                void set_identity() {
+                        std::fill(d_.begin(), d_.end(), T());
+                        for (size_type b = 0; b < blocks(); ++b)
+                                for (size_type i = 0; i < N; ++i)
+                                        std::fill(lane(b, i, i), lane(b, i, i) + block_size, static_cast<T>(1));
+                }
+
+                bool operator==(const MatrixBatch<T, N>& other) const {
+                        return size_ == other.size_ && d_ == other.d_;
+                }
+
+        private:
+                size_type index(size_type m, size_type row, size_type col) const {
+                        return m / block_size * block_entries + (row * N + col) * block_size + m % block_size;
+                }
+        };
+
+        template<typename T, std::size_t N>
+        const typename MatrixBatch<T, N>::size_type MatrixBatch<T, N>::block_size;
+
+        template<typename T, std::size_t N>
+        const typename MatrixBatch<T, N>::size_type MatrixBatch<T, N>::block_entries;
+
+        // Reductions applied once per entry of a product, after its N terms are
+        // summed.
+        template<typename T>
+        struct no_reduction {
+                T operator()(const T& x) const { return x; }
+        };
+
+        // x mod p for 0 <= x < 2^62 without a division: the quotient estimated
+        // in double precision is off by at most one, which the two selects fix.
+        template<typename T>
+        struct double_reduction {
+                T p;
+                double inverse;
+
+                explicit double_reduction(const T& mod) : p(mod), inverse(1.0 / static_cast<double>(mod)) { }
+
+                T operator()(const T& x) const {
+                        T r = x - static_cast<T>(static_cast<double>(x) * inverse) * p;
+                        r = r < T() ? r + p : r;
+                        return r >= p ? r - p : r;
+                }
+        };
+
+        // One block of left * right into out, which may be either operand.
+        template<typename T, std::size_t N, typename Reduce>
+        void multiply_block(const T* left, const T* right, T* out, const Reduce& reduce) {
+                typedef typename MatrixBatch<T, N>::size_type st;
+                const st w = MatrixBatch<T, N>::block_size;
+                T r[N * N * w];
+                for (st i = 0; i < N; ++i) {
+                        for (st j = 0; j < N; ++j) {
+                                T* o = r + (i * N + j) * w;
+                                for (st x = 0; x < w; ++x) {
+                                        T s = left[i * N * w + x] * right[j * w + x];
+                                        for (st k = 1; k < N; ++k)
+                                                s += left[(i * N + k) * w + x] * right[(k * N + j) * w + x];
+                                        o[x] = reduce(s);
+                                }
+                        }
+                }
+                std::copy(r, r + N * N * w, out);
+        }
+
+        // Fallback for a modulo too large to sum N unreduced products in T:
+        // every term is reduced on its own.
+        template<typename T, std::size_t N>
+        void multiply_block_modulo(const T* left, const T* right, T* out, const T& mod) {
+                typedef typename MatrixBatch<T, N>::size_type st;
+                const st w = MatrixBatch<T, N>::block_size;
+                T r[N * N * w];
+                for (st i = 0; i < N; ++i) {
+                        for (st j = 0; j < N; ++j) {
+                                T* o = r + (i * N + j) * w;
+                                for (st x = 0; x < w; ++x) {
+                                        T s = T();
+                                        for (st k = 0; k < N; ++k)
+                                                s = (s + (left[(i * N + k) * w + x] * right[(k * N + j) * w + x]) % mod) % mod;
+                                        o[x] = s;
+                                }
+                        }
+                }
+                std::copy(r, r + N * N * w, out);
+        }
+
+        template<typename T, std::size_t N>
+        bool is_reduced(const MatrixBatch<T, N>& m) {
+                typedef typename MatrixBatch<T, N>::size_type st;
+                for (st b = 0; b < m.blocks(); ++b) {
+                        const T* d = m.lane(b, 0, 0);
+                        for (st e = 0; e < MatrixBatch<T, N>::block_entries; ++e) {
+                                if (d[e] < T() || !(d[e] < m.modulo()))
+                                        return false;
+                        }
+                }
+                return true;
+        }
+
+        template<typename T, std::size_t N>
+        void multiply_modulo(const MatrixBatch<T, N>& left, const MatrixBatch<T, N>& right, MatrixBatch<T, N>& out, std::true_type) {
+                typedef typename MatrixBatch<T, N>::size_type st;
+                const T mod = left.modulo();
+                // The double quotient needs a signed T and sums below 2^62.
+                const bool fast = std::is_signed<T>::value && unreduced_terms(mod) >= static_cast<T>(N)
+                        && static_cast<double>(mod) * mod * N < 4.6e18 && is_reduced(left) && is_reduced(right);
+                if (fast) {
+                        const double_reduction<T> reduce(mod);
+                        for (st b = 0; b < left.blocks(); ++b)
+                                multiply_block<T, N>(left.lane(b, 0, 0), right.lane(b, 0, 0), out.lane(b, 0, 0), reduce);
+                        return;
+                }
+                for (st b = 0; b < left.blocks(); ++b)
+                        multiply_block_modulo<T, N>(left.lane(b, 0, 0), right.lane(b, 0, 0), out.lane(b, 0, 0), mod);
+        }
+
+        template<typename T, std::size_t N>
+        void multiply_modulo(const MatrixBatch<T, N>&, const MatrixBatch<T, N>&, MatrixBatch<T, N>&, std::false_type) {
+                throw std::runtime_error("modulo needs an integral type");
+        }
+
+        // out[m] = left[m] * right[m] for every m. out may be left or right and
+        // is reused as is, so a loop of products allocates nothing.
+        template<typename T, std::size_t N>
+        void multiply(const MatrixBatch<T, N>& left, const MatrixBatch<T, N>& right, MatrixBatch<T, N>& out) {
+                typedef typename MatrixBatch<T, N>::size_type st;
+                if (left.size() != right.size() || left.size() != out.size())
+                        throw std::runtime_error("batch sizes differ");
+                if (left.modulo() != right.modulo() || left.modulo() != out.modulo())
+                        throw std::runtime_error("left.modulo != right.modulo");
+                if (left.modulo() != T()) {
+                        multiply_modulo(left, right, out, std::is_integral<T>());
+                        return;
+                }
+                for (st b = 0; b < left.blocks(); ++b)
+                        multiply_block<T, N>(left.lane(b, 0, 0), right.lane(b, 0, 0), out.lane(b, 0, 0), no_reduction<T>());
+        }
+
+        template<typename T, std::size_t N>
+        MatrixBatch<T, N> operator*(const MatrixBatch<T, N>& left, const MatrixBatch<T, N>& right) {
+                MatrixBatch<T, N> r(left.modulo(), left.size());
+                multiply(left, right, r);
+                return r;
+        }
+
+        // Every matrix to the power p.
+        template<typename T, std::size_t N>
+        MatrixBatch<T, N> mpow(const MatrixBatch<T, N>& m, unsigned p) {
+                MatrixBatch<T, N> result(m.modulo(), m.size());
+                result.set_identity();
+                if (p == 0)
+                        return result;
+                auto mToPower = m;
+                while ((p & 1u) == 0) {
+                        multiply(mToPower, mToPower, mToPower);
+                        p >>= 1;
+                }
+                result = mToPower;
+                for (p >>= 1; p != 0; p >>= 1) {
+                        multiply(mToPower, mToPower, mToPower);
+                        if ((p & 1u) != 0)
+                                multiply(result, mToPower, result);
+                }
+                return result;
+        }
+
+        // Matrix m to the power p[m]. Every squaring and product covers the
+        // whole batch; a matrix whose exponent lacks the current bit keeps its
+        // value through a select, so the cost follows the largest exponent.
+        template<typename T, std::size_t N>
+        MatrixBatch<T, N> mpow(const MatrixBatch<T, N>& m, const std::vector<unsigned>& p) {
+                typedef typename MatrixBatch<T, N>::size_type st;
+                const st w = MatrixBatch<T, N>::block_size;
+                if (p.size() != m.size())
+                        throw std::runtime_error("one exponent per matrix needed");
+                MatrixBatch<T, N> result(m.modulo(), m.size());
+                result.set_identity();
+                unsigned highest = 0;
+                for (unsigned e : p)
+                        highest |= e;
+                if (highest == 0)
+                        return result;
+
+                std::vector<unsigned> bits(m.blocks() * w);
+                std::copy(p.begin(), p.end(), bits.begin());
+                auto mToPower = m;
+                MatrixBatch<T, N> product(m.modulo(), m.size());
+                for (;;) {
+                        multiply(result, mToPower, product);
+                        for (st b = 0; b < m.blocks(); ++b) {
+                                const unsigned* e = bits.data() + b * w;
+                                T* r = result.lane(b, 0, 0);
+                                const T* q = product.lane(b, 0, 0);
+                                for (st entry = 0; entry < N * N; ++entry, r += w, q += w) {
+                                        for (st x = 0; x < w; ++x)
+                                                r[x] = (e[x] & 1u) != 0 ? q[x] : r[x];
+                                }
+                        }
+                        highest >>= 1;
+                        if (highest == 0)
+                                return result;
+                        for (auto& e : bits)
+                                e >>= 1;
+                        multiply(mToPower, mToPower, mToPower);
+                }
+        }
+
+}
+
+#endif // TC_MATRIX_BATCH_H
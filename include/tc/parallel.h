@@ -0,0 +1,321 @@
+#pragma once
+
+#ifndef TC_PARALLEL_H
+#define TC_PARALLEL_H
+
+#include "tc/tree.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tc
+{
+
+// Fixed set of workers, each owning a deque of task indices. An owner pops
+// from the back of its own deque, idle workers steal from the front of the
+// others. The thread calling run() takes part as worker 0.
+class work_stealing_pool
+{
+public:
+  explicit work_stealing_pool(unsigned threads = 0)
+    : _queues(threads ? threads : std::max(1u, std::thread::hardware_concurrency())),
+      _generation(0), _pending(0), _stop(false)
+  {
+    for (unsigned i = 1; i < _queues.size(); ++i)
+      _threads.emplace_back([this, i] { worker(i); });
+  }
+
+  work_stealing_pool(const work_stealing_pool&) = delete;
+  work_stealing_pool& operator=(const work_stealing_pool&) = delete;
+
+  ~work_stealing_pool()
+  {
+    {
+      std::lock_guard<std::mutex> lk(_m);
+      _stop = true;
+    }
+    _cv.notify_all();
+    for (auto& t : _threads)
+      t.join();
+  }
+
+  unsigned size() const
+  { return static_cast<unsigned>(_queues.size()); }
+
+  // Calls task(i) for every i in [0, n) and blocks until all calls return.
+  // Tasks must not call run() on the same pool.
+  template<typename Task>
+  void run(std::size_t n, Task task)
+  {
+    if (n == 0)
+      return;
+    std::lock_guard<std::mutex> run_lk(_run_m);
+    _job = task;
+    _error = nullptr;
+    _pending = n;
+    // Contiguous blocks keep neighbouring subtrees on one worker until stolen.
+    const std::size_t w = _queues.size();
+    for (std::size_t q = 0; q < w; ++q) {
+      std::lock_guard<std::mutex> lk(_queues[q].m);
+      for (std::size_t i = q * n / w; i < (q + 1) * n / w; ++i)
+        _queues[q].items.push_back(i);
+    }
+    {
+      std::lock_guard<std::mutex> lk(_m);
+      ++_generation;
+    }
+    _cv.notify_all();
+
+    drain(0);
+
+    std::unique_lock<std::mutex> lk(_m);
+    _done_cv.wait(lk, [this] { return _pending.load() == 0; });
+    if (_error)
+      std::rethrow_exception(_error);
+  }
+
+  static work_stealing_pool& shared()
+  {
+    static work_stealing_pool pool;
+    return pool;
+  }
+
+private:
+  struct task_queue
+  {
+    std::mutex m;
+    std::deque<std::size_t> items;
+  };
+
+  bool pop(unsigned self, std::size_t& i)
+  {
+    auto& q = _queues[self];
+    std::lock_guard<std::mutex> lk(q.m);
+    if (q.items.empty())
+      return false;
+    i = q.items.back();
+    q.items.pop_back();
+    return true;
+  }
+
+  bool steal(unsigned self, std::size_t& i)
+  {
+    for (std::size_t k = 1; k < _queues.size(); ++k) {
+      auto& q = _queues[(self + k) % _queues.size()];
+      std::lock_guard<std::mutex> lk(q.m);
+      if (!q.items.empty()) {
+        i = q.items.front();
+        q.items.pop_front();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void drain(unsigned self)
+  {
+    std::size_t i;
+    while (pop(self, i) || steal(self, i)) {
+      try {
+        _job(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lk(_m);
+        if (!_error)
+          _error = std::current_exception();
+      }
+      if (_pending.fetch_sub(1) == 1) {
+        std::lock_guard<std::mutex> lk(_m);
+        _done_cv.notify_all();
+      }
+    }
+  }
+
+  void worker(unsigned self)
+  {
+    unsigned long long seen = 0;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lk(_m);
+        _cv.wait(lk, [&] { return _stop || _generation != seen; });
+        if (_stop)
+          return;
+        seen = _generation;
+      }
+      drain(self);
+    }
+  }
+
+  std::vector<task_queue> _queues;
+  std::vector<std::thread> _threads;
+  std::function<void(std::size_t)> _job;
+  std::exception_ptr _error;
+  std::mutex _run_m;
+  std::mutex _m;
+  std::condition_variable _cv;
+  std::condition_variable _done_cv;
+  unsigned long long _generation;
+  std::atomic<std::size_t> _pending;
+  bool _stop;
+};
+
+// A piece of the tree handed to one task: either a whole subtree cut at the
+// split depth or a single node above it.
+template<class Node>
+struct tree_piece
+{
+  const Node* node;
+  unsigned level;
+  bool subtree;
+};
+
+template<class Node>
+void split_tree(const Node* n, unsigned level, unsigned depth, std::vector<tree_piece<Node>>& out)
+{
+  using nt = node_traits<Node>;
+  if (n == nullptr)
+    return;
+  if (depth == 0) {
+    out.push_back({n, level, true});
+    return;
+  }
+  split_tree(nt::left(n), level + 1, depth - 1, out);
+  out.push_back({n, level, false});
+  split_tree(nt::right(n), level + 1, depth - 1, out);
+}
+
+// Pieces in in-order sequence, enough of them to keep every worker busy.
+template<class Tree>
+std::vector<tree_piece<typename Tree::node_type>> split_tree(const Tree& tree, unsigned workers)
+{
+  unsigned depth = 0;
+  while ((1u << depth) < workers * 8u)
+    ++depth;
+  std::vector<tree_piece<typename Tree::node_type>> pieces;
+  split_tree(tree.croot(), 1u, depth, pieces);
+  return pieces;
+}
+
+// In-order walk of the subtree under root using parent links only; nodes
+// marked erased are passed over.
+template<class Node, typename Callback>
+void subtree_inorder(const Node* root, unsigned level, Callback cb)
+{
+  using nt = node_traits<Node>;
+  auto cur = root;
+  while (nt::left(cur) != nullptr) {
+    cur = nt::left(cur);
+    ++level;
+  }
+  for (;;) {
+    if (nt::live(cur))
+      cb(nt::key(cur), level);
+    if (nt::right(cur) != nullptr) {
+      cur = nt::right(cur);
+      ++level;
+      while (nt::left(cur) != nullptr) {
+        cur = nt::left(cur);
+        ++level;
+      }
+      continue;
+    }
+    for (;;) {
+      if (cur == root)
+        return;
+      auto parent = nt::parent(cur);
+      --level;
+      bool from_left = nt::left(parent) == cur;
+      cur = parent;
+      if (from_left)
+        break;
+    }
+  }
+}
+
+template<class Tree, typename Callback>
+void parallel_for_each(const Tree& tree, Callback cb, work_stealing_pool& pool)
+{
+  auto pieces = split_tree(tree, pool.size());
+  pool.run(pieces.size(), [&](std::size_t i) {
+    const auto& p = pieces[i];
+    if (p.subtree)
+      subtree_inorder(p.node, p.level, cb);
+    else if (node_traits<typename Tree::node_type>::live(p.node))
+      cb(node_traits<typename Tree::node_type>::key(p.node), p.level);
+  });
+}
+
+// Calls cb(key, level) for every node, concurrently from several threads.
+template<class Tree, typename Callback>
+void parallel_for_each(const Tree& tree, Callback cb)
+{
+  parallel_for_each(tree, cb, work_stealing_pool::shared());
+}
+
+template<class Tree, typename Map, typename Combine>
+auto parallel_reduce(const Tree& tree, Map map, Combine combine, work_stealing_pool& pool)
+  -> decltype(map(node_traits<typename Tree::node_type>::key(tree.croot()), 1u))
+{
+  using node_type = typename Tree::node_type;
+  using nt = node_traits<node_type>;
+  using result_type = decltype(map(nt::key(tree.croot()), 1u));
+
+  // Wrapped so that a bool result does not end up packed in vector<bool>.
+  // A piece of erased-marked nodes only leaves its slot unset.
+  struct slot
+  {
+    result_type value;
+    bool set = false;
+  };
+
+  auto pieces = split_tree(tree, pool.size());
+  std::vector<slot> partial(pieces.size());
+  pool.run(pieces.size(), [&](std::size_t i) {
+    const auto& p = pieces[i];
+    if (!p.subtree) {
+      if (nt::live(p.node)) {
+        partial[i].value = map(nt::key(p.node), p.level);
+        partial[i].set = true;
+      }
+      return;
+    }
+    subtree_inorder(p.node, p.level, [&](const typename nt::value_type& key, unsigned level) {
+      if (!partial[i].set) {
+        partial[i].value = map(key, level);
+        partial[i].set = true;
+      } else {
+        partial[i].value = combine(std::move(partial[i].value), map(key, level));
+      }
+    });
+  });
+
+  // Pieces are in key order, so the result does not depend on scheduling.
+  result_type result = result_type();
+  bool first = true;
+  for (auto& s : partial) {
+    if (!s.set)
+      continue;
+    result = first ? std::move(s.value) : combine(std::move(result), std::move(s.value));
+    first = false;
+  }
+  return result;
+}
+
+// Folds map(key, level) over all nodes in key order with an associative
+// combine. An empty tree yields a value-initialized result.
+template<class Tree, typename Map, typename Combine>
+auto parallel_reduce(const Tree& tree, Map map, Combine combine)
+  -> decltype(map(node_traits<typename Tree::node_type>::key(tree.croot()), 1u))
+{
+  return parallel_reduce(tree, map, combine, work_stealing_pool::shared());
+}
+
+}
+
+#endif
@@ -0,0 +1,202 @@
+#pragma once
+
+#ifndef TC_PERF_COUNTERS_H
+#define TC_PERF_COUNTERS_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+namespace tc
+{
+
+	enum perf_event
+	{
+		perf_cycles,
+		perf_instructions,
+		perf_l1d_misses,
+		perf_llc_misses,
+		perf_branch_misses,
+		perf_event_count
+	};
+
+	// Figures for one measured region. A counter that could not be opened
+	// reads as perf_sample::unavailable; seconds is always set.
+	struct perf_sample
+	{
+		static const std::uint64_t unavailable = ~std::uint64_t(0);
+
+		double seconds;
+		std::uint64_t counters[perf_event_count];
+
+		perf_sample() : seconds(0)
+		{
+			for (auto& c : counters)
+				c = unavailable;
+		}
+
+		bool has(perf_event e) const
+		{ return counters[e] != unavailable; }
+
+		std::uint64_t operator[](perf_event e) const
+		{ return counters[e]; }
+	};
+
+	inline const char* perf_event_name(perf_event e)
+	{
+		static const char* names[] = {"cycles", "instructions", "L1d-misses", "LLC-misses", "branch-misses"};
+		return names[e];
+	}
+
+	// One line with every figure divided by ops, skipping unavailable counters:
+	//   12.3 ns, 40.1 cycles, 55.0 instructions, ... per op
+	inline void write_per_op(std::ostream& os, const perf_sample& s, std::size_t ops)
+	{
+		const double n = ops ? double(ops) : 1.0;
+		char buf[64];
+		std::snprintf(buf, sizeof(buf), "%.1f ns", s.seconds * 1e9 / n);
+		os << buf;
+		for (int e = 0; e < perf_event_count; ++e) {
+			if (!s.has(perf_event(e)))
+				continue;
+			std::snprintf(buf, sizeof(buf), ", %.2f %s", s[perf_event(e)] / n, perf_event_name(perf_event(e)));
+			os << buf;
+		}
+		os << " per op";
+	}
+
+	// User-space hardware counters of the calling thread through
+	// perf_event_open. Each event is opened on its own, so a PMU lacking one
+	// of them, or a container forbidding all of them, degrades to whatever is
+	// left, down to wall-clock time only. Counts are scaled when the kernel
+	// multiplexes the events.
+	class perf_counters
+	{
+	public:
+		explicit perf_counters(bool enable = true)
+		{
+			for (auto& fd : _fd)
+				fd = -1;
+#if defined(__linux__)
+			if (!enable)
+				return;
+			const std::uint64_t cache_miss = (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+			open(perf_cycles, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+			open(perf_instructions, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+			open(perf_l1d_misses, PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | cache_miss);
+			open(perf_llc_misses, PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | cache_miss);
+			open(perf_branch_misses, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+#else
+			(void)enable;
+#endif
+		}
+
+		perf_counters(const perf_counters&) = delete;
+		perf_counters& operator=(const perf_counters&) = delete;
+
+		~perf_counters()
+		{
+#if defined(__linux__)
+			for (int fd : _fd)
+				if (fd >= 0)
+					::close(fd);
+#endif
+		}
+
+		// True if at least one hardware counter is open.
+		bool available() const
+		{
+			for (int fd : _fd)
+				if (fd >= 0)
+					return true;
+			return false;
+		}
+
+		void start()
+		{
+#if defined(__linux__)
+			for (int fd : _fd) {
+				if (fd >= 0) {
+					::ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+					::ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+				}
+			}
+#endif
+			_start = std::chrono::steady_clock::now();
+		}
+
+		perf_sample stop()
+		{
+			auto end = std::chrono::steady_clock::now();
+			perf_sample s;
+#if defined(__linux__)
+			for (int fd : _fd)
+				if (fd >= 0)
+					::ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+			for (int e = 0; e < perf_event_count; ++e) {
+				if (_fd[e] < 0)
+					continue;
+				// value, time enabled, time running
+				std::uint64_t v[3];
+				if (::read(_fd[e], v, sizeof(v)) != sizeof(v))
+					continue;
+				s.counters[e] = v[2] == 0 ? 0 : v[2] < v[1] ? std::uint64_t(double(v[0]) * v[1] / v[2]) : v[0];
+			}
+#endif
+			s.seconds = std::chrono::duration<double>(end - _start).count();
+			return s;
+		}
+
+	private:
+#if defined(__linux__)
+		void open(perf_event e, std::uint32_t type, std::uint64_t config)
+		{
+			perf_event_attr attr;
+			std::memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = type;
+			attr.config = config;
+			attr.disabled = 1;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+			_fd[e] = static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+		}
+#endif
+
+		int _fd[perf_event_count];
+		std::chrono::steady_clock::time_point _start;
+	};
+
+	// Measures its own lifetime into out:
+	//   { perf_scope scope(counters, sample); ...region... }
+	class perf_scope
+	{
+	public:
+		perf_scope(perf_counters& counters, perf_sample& out) : _counters(counters), _out(out)
+		{ _counters.start(); }
+
+		perf_scope(const perf_scope&) = delete;
+		perf_scope& operator=(const perf_scope&) = delete;
+
+		~perf_scope()
+		{ _out = _counters.stop(); }
+
+	private:
+		perf_counters& _counters;
+		perf_sample& _out;
+	};
+
+}
+
+#endif
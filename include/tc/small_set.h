@@ -0,0 +1,251 @@
+#pragma once
+
+#ifndef TC_SMALL_SET_H
+#define TC_SMALL_SET_H
+
+#include "tc/avl_tree.h"
+#include "tc/btree.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+
+namespace tc
+{
+
+	// Set keeping up to N keys sorted in an inline array, no allocation at
+	// all, and switching to an avl_tree when a key is added beyond N. It
+	// returns to the array once the tree is down to N / 2 keys, so a set
+	// hovering around N does not flip on every operation. Keys must be
+	// default constructible and assignable.
+	// The operations mirror avl_tree's, but an inline key has no node:
+	// insert and erase report whether the set changed and find returns the
+	// stored key, where avl_tree deals in node pointers. Comp is a boolean
+	// less; the inline search has no three-way path.
+	template<typename T, std::size_t N = 16, typename Comp = std::less<T>>
+	class small_set
+	{
+		static_assert(N >= 2, "small_set needs room for at least two inline keys");
+		static_assert(!is_three_way<Comp>::value, "small_set needs a less-than comparator");
+	public:
+		using size_type = std::size_t;
+		using value_type = T;
+		using tree_type = avl_tree<T, Comp>;
+
+		static const size_type inline_capacity = N;
+
+		class const_iterator
+		{
+		public:
+			using iterator_category = std::forward_iterator_tag;
+			using value_type = T;
+			using difference_type = std::ptrdiff_t;
+			using pointer = const T*;
+			using reference = const T&;
+
+			const_iterator() : _key(nullptr), _node(nullptr)
+			{ }
+
+			reference operator*() const
+			{ return _node ? _node->key : *_key; }
+
+			pointer operator->() const
+			{ return &**this; }
+
+			const_iterator& operator++()
+			{
+				if (_node)
+					_node = avl_next(_node);
+				else
+					++_key;
+				return *this;
+			}
+
+			const_iterator operator++(int)
+			{
+				auto r = *this;
+				++*this;
+				return r;
+			}
+
+			bool operator==(const const_iterator& o) const
+			{ return _key == o._key && _node == o._node; }
+
+			bool operator!=(const const_iterator& o) const
+			{ return !(*this == o); }
+
+		private:
+			friend class small_set;
+			using node_type = typename tree_type::node_type;
+
+			const_iterator(const T* key, const node_type* node) : _key(key), _node(node)
+			{ }
+
+			const T* _key;          // inline mode
+			const node_type* _node; // tree mode, nullptr at the end
+		};
+
+		small_set() : _size(0u)
+		{ }
+
+		small_set(const small_set& other)
+			: _comp(other._comp), _size(other._size), _tree(other._tree ? new tree_type(*other._tree) : nullptr)
+		{ std::copy(other._keys, other._keys + other.inline_size(), _keys); }
+
+		small_set(small_set&& other) noexcept
+			: _comp(other._comp), _size(other._size), _tree(std::move(other._tree))
+		{
+			std::move(other._keys, other._keys + inline_size(), _keys);
+			other._size = 0;
+		}
+
+		small_set& operator=(small_set other) noexcept
+		{
+			swap(other);
+			return *this;
+		}
+
+		void swap(small_set& other) noexcept
+		{
+			using std::swap;
+			swap(_comp, other._comp);
+			swap(_size, other._size);
+			swap(_tree, other._tree);
+			swap(_keys, other._keys);
+		}
+
+		size_type size() const
+		{ return _size; }
+
+		bool empty() const
+		{ return _size == 0; }
+
+		// True while the keys live in the inline array.
+		bool is_inline() const
+		{ return !_tree; }
+
+		const_iterator begin() const
+		{
+			if (_tree)
+				return const_iterator(nullptr, _tree->cleftmost());
+			return const_iterator(_keys, nullptr);
+		}
+
+		const_iterator end() const
+		{ return _tree ? const_iterator() : const_iterator(_keys + _size, nullptr); }
+
+		// Adds value unless an equivalent key is present; true if added.
+		bool insert(const T& value);
+
+		// Removes the key equivalent to key; true if there was one.
+		bool erase(const T& key);
+
+		// Stored key equivalent to key or nullptr.
+		const T* find(const T& key) const
+		{
+			if (_tree) {
+				auto n = _tree->find(key);
+				return n ? &n->key : nullptr;
+			}
+			size_type i = lower_bound(key);
+			return i < _size && !_comp(key, _keys[i]) ? &_keys[i] : nullptr;
+		}
+
+		bool contains(const T& key) const
+		{ return find(key) != nullptr; }
+
+		void clear()
+		{
+			_tree.reset();
+			_size = 0;
+		}
+
+	private:
+		using linear_search = std::integral_constant<bool,
+			std::is_arithmetic<T>::value && std::is_same<Comp, std::less<T>>::value>;
+
+		size_type inline_size() const
+		{ return _tree ? 0 : _size; }
+
+		// Arithmetic keys are compared all at once, the way btree searches a node.
+		size_type lower_bound(const T& key) const
+		{ return btree_rank(_comp, _keys, _size, key, false, linear_search()); }
+
+		void promote();
+		void demote();
+
+		Comp _comp;
+		size_type _size;
+		std::unique_ptr<tree_type> _tree;
+		T _keys[N];
+	};
+
+	template<typename T, std::size_t N, typename Comp>
+	bool small_set<T, N, Comp>::insert(const T& value) {
+		if (_tree) {
+			const size_type before = _tree->size();
+			_tree->insert(value);
+			_size = _tree->size();
+			return _size != before;
+		}
+		size_type i = lower_bound(value);
+		if (i < _size && !_comp(value, _keys[i]))
+			return false;
+		if (_size == N) {
+			promote();
+			_tree->insert(value);
+			_size = _tree->size();
+			return true;
+		}
+		std::move_backward(_keys + i, _keys + _size, _keys + _size + 1);
+		_keys[i] = value;
+		++_size;
+		return true;
+	}
+
+	template<typename T, std::size_t N, typename Comp>
+	bool small_set<T, N, Comp>::erase(const T& key) {
+		if (_tree) {
+			const size_type before = _tree->size();
+			_tree->erase(key);
+			_size = _tree->size();
+			if (_size <= N / 2)
+				demote();
+			return _size != before;
+		}
+		size_type i = lower_bound(key);
+		if (i == _size || _comp(key, _keys[i]))
+			return false;
+		std::move(_keys + i + 1, _keys + _size, _keys + i);
+		--_size;
+		return true;
+	}
+
+	// Sorted keys are appended at the tree's rightmost node without a search.
+	template<typename T, std::size_t N, typename Comp>
+	void small_set<T, N, Comp>::promote() {
+		std::unique_ptr<tree_type> tree(new tree_type());
+		for (size_type i = 0; i < _size; ++i)
+			tree->append(_keys[i]);
+		_tree = std::move(tree);
+	}
+
+	template<typename T, std::size_t N, typename Comp>
+	void small_set<T, N, Comp>::demote() {
+		size_type i = 0;
+		for (auto it = begin(); it != end(); ++it)
+			_keys[i++] = *it;
+		_tree.reset();
+	}
+
+	template<typename T, std::size_t N, typename Comp>
+	void swap(small_set<T, N, Comp>& a, small_set<T, N, Comp>& b) noexcept {
+		a.swap(b);
+	}
+
+}
+
+#endif
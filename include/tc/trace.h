@@ -0,0 +1,235 @@
+#pragma once
+
+#ifndef TC_TRACE_H
+#define TC_TRACE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace tc
+{
+
+	// Binary trace of tree operations. A 16 byte header:
+	//
+	//   char[8]   "TCTRACE1"
+	//   uint32    0x01020304, byte order of the writer
+	//   uint16    format version (1)
+	//   uint16    key size in bytes
+	//
+	// followed by packed records of one op byte and the raw key bytes. There
+	// is no record count: a reader derives it from the length and ignores a
+	// trailing partial record, so a trace cut short by a crash stays usable.
+	enum class trace_op : std::uint8_t
+	{
+		insert = 0,
+		erase = 1,
+		lookup = 2
+	};
+
+	struct trace_header
+	{
+		char magic[8];
+		std::uint32_t byte_order;
+		std::uint16_t version;
+		std::uint16_t key_size;
+	};
+
+	static_assert(sizeof(trace_header) == 16, "trace header must be packed");
+
+	const char trace_magic[8] = {'T', 'C', 'T', 'R', 'A', 'C', 'E', '1'};
+	const std::uint32_t trace_byte_order = 0x01020304u;
+	const std::uint16_t trace_version = 1;
+
+	// Appends records for keys of a trivially copyable type T. Records are
+	// buffered and handed to the stream in blocks; flush() or destruction
+	// writes out the rest.
+	template<typename T>
+	class trace_writer
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "trace keys are stored as raw bytes");
+	public:
+		static const std::size_t record_size = 1 + sizeof(T);
+
+		explicit trace_writer(std::ostream& os, std::size_t buffer_records = 4096)
+			: _os(os), _capacity(buffer_records * record_size), _records(0)
+		{
+			trace_header h;
+			std::memcpy(h.magic, trace_magic, sizeof(h.magic));
+			h.byte_order = trace_byte_order;
+			h.version = trace_version;
+			h.key_size = sizeof(T);
+			_os.write(reinterpret_cast<const char*>(&h), sizeof(h));
+			_buf.reserve(_capacity);
+		}
+
+		trace_writer(const trace_writer&) = delete;
+		trace_writer& operator=(const trace_writer&) = delete;
+
+		~trace_writer()
+		{ flush(); }
+
+		void record(trace_op op, const T& key)
+		{
+			const std::size_t at = _buf.size();
+			_buf.resize(at + record_size);
+			_buf[at] = static_cast<char>(op);
+			std::memcpy(&_buf[at + 1], &key, sizeof(T));
+			++_records;
+			if (_buf.size() >= _capacity)
+				flush();
+		}
+
+		void flush()
+		{
+			if (!_buf.empty())
+				_os.write(_buf.data(), _buf.size());
+			_buf.clear();
+			_os.flush();
+		}
+
+		std::size_t records() const
+		{ return _records; }
+
+	private:
+		std::ostream& _os;
+		std::vector<char> _buf;
+		std::size_t _capacity;
+		std::size_t _records;
+	};
+
+	// Read-only view of a trace held in memory, e.g. a mapped file. Keys are
+	// copied out with memcpy, so the records need no alignment.
+	template<typename T>
+	class trace_view
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "trace keys are stored as raw bytes");
+	public:
+		static const std::size_t record_size = 1 + sizeof(T);
+
+		// Throws std::invalid_argument unless data starts with a valid header
+		// for keys of type T written with the same byte order and every
+		// record has a known op. The op bytes are checked here, in one pass,
+		// so that op() never yields a value outside trace_op.
+		trace_view(const void* data, std::size_t bytes)
+			: _data(static_cast<const char*>(data))
+		{
+			trace_header h;
+			if (bytes < sizeof(h))
+				throw std::invalid_argument("trace: too short for a header");
+			std::memcpy(&h, _data, sizeof(h));
+			if (std::memcmp(h.magic, trace_magic, sizeof(h.magic)) != 0)
+				throw std::invalid_argument("trace: bad magic");
+			if (h.byte_order != trace_byte_order)
+				throw std::invalid_argument("trace: written with another byte order");
+			if (h.version != trace_version)
+				throw std::invalid_argument("trace: unsupported version");
+			if (h.key_size != sizeof(T))
+				throw std::invalid_argument("trace: key size does not match");
+			_data += sizeof(h);
+			_size = (bytes - sizeof(h)) / record_size;
+			for (std::size_t i = 0; i < _size; ++i) {
+				if (static_cast<unsigned char>(_data[i * record_size]) > static_cast<unsigned char>(trace_op::lookup))
+					throw std::invalid_argument("trace: bad op in record " + std::to_string(i));
+			}
+		}
+
+		// Key size recorded in a header, to pick T before making a view.
+		static std::size_t key_size(const void* data, std::size_t bytes)
+		{
+			trace_header h;
+			if (bytes < sizeof(h))
+				throw std::invalid_argument("trace: too short for a header");
+			std::memcpy(&h, data, sizeof(h));
+			return h.key_size;
+		}
+
+		std::size_t size() const
+		{ return _size; }
+
+		trace_op op(std::size_t i) const
+		{ return static_cast<trace_op>(_data[i * record_size]); }
+
+		T key(std::size_t i) const
+		{
+			T k;
+			std::memcpy(&k, _data + i * record_size + 1, sizeof(T));
+			return k;
+		}
+
+	private:
+		const char* _data;
+		std::size_t _size;
+	};
+
+	// Tree wrapper recording every insert, erase and lookup while a writer is
+	// attached; with none attached the cost is one test per operation.
+	template<class Tree>
+	class traced_tree
+	{
+	public:
+		using value_type = typename Tree::value_type;
+		using writer_type = trace_writer<value_type>;
+
+		explicit traced_tree(writer_type* writer = nullptr) : _writer(writer)
+		{ }
+
+		void set_writer(writer_type* writer)
+		{ _writer = writer; }
+
+		auto insert(const value_type& v) -> decltype(std::declval<Tree&>().insert(v))
+		{
+			if (_writer)
+				_writer->record(trace_op::insert, v);
+			return _tree.insert(v);
+		}
+
+		void erase(const value_type& v)
+		{
+			if (_writer)
+				_writer->record(trace_op::erase, v);
+			_tree.erase(v);
+		}
+
+		auto find(const value_type& v) const -> decltype(std::declval<const Tree&>().find(v))
+		{
+			if (_writer)
+				_writer->record(trace_op::lookup, v);
+			return _tree.find(v);
+		}
+
+		bool contains(const value_type& v) const
+		{ return find(v) != nullptr; }
+
+		const Tree& tree() const
+		{ return _tree; }
+
+	private:
+		Tree _tree;
+		writer_type* _writer;
+	};
+
+	// Applies the recorded operations to a tree with insert, erase and
+	// contains; returns how many lookups found their key.
+	template<typename T, class Tree>
+	std::size_t replay(const trace_view<T>& trace, Tree& tree)
+	{
+		std::size_t found = 0;
+		for (std::size_t i = 0; i < trace.size(); ++i) {
+			switch (trace.op(i)) {
+			case trace_op::insert: tree.insert(trace.key(i)); break;
+			case trace_op::erase: tree.erase(trace.key(i)); break;
+			case trace_op::lookup: found += tree.contains(trace.key(i)); break;
+			}
+		}
+		return found;
+	}
+
+}
+
+#endif
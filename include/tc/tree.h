@@ -3,21 +3,52 @@
 #ifndef TC_TREE_H
 #define TC_TREE_H
 
+#include <algorithm>
 #include <functional>
 #include <utility>
-#include <queue>
+#include <type_traits>
 #include <cmath>
 #include <cassert>
-#include <map>
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <limits>
+#include <vector>
 
 namespace tc
 {
 
+// Detects nodes that keep an AVL balance factor (right height - left height).
+template<class Node, class = void>
+struct has_balance : std::false_type
+{ };
+
+template<class Node>
+struct has_balance<Node, decltype((void)std::declval<const Node&>().balance)> : std::true_type
+{ };
+
+// Detects nodes that can be marked erased (avl_tombstone) and stay linked.
+template<class Node, class = void>
+struct has_tombstone : std::false_type
+{ };
+
+template<class Node>
+struct has_tombstone<Node, decltype((void)std::declval<const Node&>().dead)> : std::true_type
+{ };
+
+template<class Node>
+bool node_is_live(const Node* n, std::true_type)
+{ return !n->dead; }
+
+template<class Node>
+bool node_is_live(const Node*, std::false_type)
+{ return true; }
+
 template<class Node>
 struct node_traits
 {
   using value_type = typename Node::value_type;
+  static const bool has_balance = tc::has_balance<Node>::value;
   // todo: fix constness
   static const Node * parent(const Node* n)
   { return n->parent; }
@@ -27,6 +58,12 @@ struct node_traits
   { return n->right; }
   static const value_type& key(const Node* n)
   { return n->key; }
+  // only for nodes with has_balance
+  static int balance(const Node* n)
+  { return n->balance; }
+  // false for nodes marked erased; traversals skip their keys
+  static bool live(const Node* n)
+  { return node_is_live(n, has_tombstone<Node>()); }
   //todo: remove in bst min,max
   static value_type min()
   { return std::numeric_limits<value_type>::min(); }
@@ -34,63 +71,121 @@ struct node_traits
   { return std::numeric_limits<value_type>::max(); }
 
 };
-// todo: use iterative solution
 
 template<class Node>
-bool is_bst_helper(const Node * root, const typename Node::value_type& left_bound, const typename Node::value_type& right_bound) {
+bool stored_balance_matches(const Node* n, int lh, int rh, std::true_type)
+{ return node_traits<Node>::balance(n) == rh - lh; }
+
+template<class Node>
+bool stored_balance_matches(const Node*, int, int, std::false_type)
+{ return true; }
+
+// The tree's comparator when it exposes key_comp(), else std::less.
+template<class Tree>
+auto tree_comparator(const Tree& tree, int) -> decltype(tree.key_comp())
+{ return tree.key_comp(); }
+
+template<class Tree>
+std::less<typename node_traits<typename Tree::node_type>::value_type> tree_comparator(const Tree&, long)
+{ return {}; }
+
+// a before b under comp, which is a boolean less or a three-way comparator
+// returning <0, 0 or >0.
+template<class Comp, class T>
+bool ordered_before(const Comp& comp, const T& a, const T& b, std::true_type)
+{ return comp(a, b); }
+
+template<class Comp, class T>
+bool ordered_before(const Comp& comp, const T& a, const T& b, std::false_type)
+{ return comp(a, b) < 0; }
+
+template<class Comp, class T>
+bool ordered_before(const Comp& comp, const T& a, const T& b)
+{ return ordered_before(comp, a, b, std::is_same<decltype(comp(a, b)), bool>()); }
+
+// Single iterative pass over the tree: checks parent links always, strict
+// in-order key ordering under the tree's comparator and/or AVL height
+// balance on request. Uses an explicit stack, so degenerate (list-like)
+// trees cannot overflow the call stack.
+// Nodes with a balance factor must also store the actual height difference.
+template<class Tree>
+bool validate_tree(const Tree& tree, bool check_order, bool check_balance)
+{
+  using node_type = typename Tree::node_type;
+  using nt = node_traits<node_type>;
+  using balanced = std::integral_constant<bool, nt::has_balance>;
+  struct frame
+  {
+    const node_type* node;
+    int left_height;
+    int stage; // 0 - going left, 1 - left done, 2 - right done
+  };
+
+  auto root = tree.croot();
   if (root == nullptr)
     return true;
-  using nt = node_traits<Node>;
-  const auto& key = nt::key(root);
-  if (key <= left_bound || key >= right_bound)
+  if (nt::parent(root) != nullptr)
     return false;
-  return is_bst_helper(nt::left(root), left_bound, key)
-      && is_bst_helper(nt::right(root), key, right_bound);
+
+  const auto comp = tree_comparator(tree, 0);
+  std::vector<frame> stack;
+  stack.push_back({root, 0, 0});
+  const typename nt::value_type* prev = nullptr;
+  int height = 0; // height of the subtree finished last
+  while (!stack.empty()) {
+    auto& f = stack.back();
+    auto n = f.node;
+    if (f.stage == 0) {
+      f.stage = 1;
+      height = 0;
+      auto left = nt::left(n);
+      if (left != nullptr) {
+        if (nt::parent(left) != n)
+          return false;
+        stack.push_back({left, 0, 0});
+      }
+      continue;
+    }
+    if (f.stage == 1) {
+      f.stage = 2;
+      f.left_height = height;
+      if (check_order && prev != nullptr && !ordered_before(comp, *prev, nt::key(n)))
+        return false;
+      prev = &nt::key(n);
+      height = 0;
+      auto right = nt::right(n);
+      if (right != nullptr) {
+        if (nt::parent(right) != n)
+          return false;
+        stack.push_back({right, 0, 0});
+      }
+      continue;
+    }
+    auto lh = f.left_height;
+    stack.pop_back();
+    if (check_balance && (std::abs(lh - height) > 1
+        || !stored_balance_matches(n, lh, height, balanced())))
+      return false;
+    height = 1 + std::max(lh, height);
+  }
+  return true;
 }
 
 template<class Tree>
 bool is_bst(const Tree& tree) {
-  auto root = tree.croot();
-  if (root == nullptr)
-    return true;
-  using nt = node_traits<typename Tree::node_type>;
-  return is_bst_helper(nt::left(root), nt::min(), nt::key(root))
-      && is_bst_helper(nt::right(root), nt::key(root), nt::max());
+  return validate_tree(tree, true, false);
 }
 
 template<class Tree>
 bool is_avl_balanced_tree(const Tree& tree)
 {
-  using node_type = typename Tree::node_type;
-  using nt = node_traits<node_type>;
-  const int BAD = -1;
-  struct helper
-  {
-    // -1 not an avl tree, 0+ heights of a tree under root
-    int verify(const node_type* root)
-    {
-      if (root == nullptr)
-        return 0;
-      auto lh = verify(nt::left(root));
-      if (lh < 0)
-        return BAD;
-      auto rh = verify(nt::right(root));
-      if (rh < 0)
-        return BAD;
-      if (std::abs(lh - rh) > 1)
-        return BAD;
-      return 1 + std::max(lh, rh);
-    }
-  };
-
-  helper h;
-  return h.verify(tree.croot()) != BAD;
+  return validate_tree(tree, false, true);
 }
 
 template<class Tree>
 bool is_avl_tree(const Tree& tree)
 {
-  return is_bst(tree) && is_avl_balanced_tree(tree);
+  return validate_tree(tree, true, true);
 }
 
 template<class Tree, typename PreO, typename InO, typename PostO>
@@ -102,24 +197,28 @@ void traverse(const Tree& tree, PreO pre, InO in, PostO post)
   auto cur = tree.croot();
   unsigned level = 1u;
   while (cur != nullptr) {
-    pre(nt::key(cur), level);
+    if (nt::live(cur))
+      pre(nt::key(cur), level);
     if (nt::left(cur) != nullptr) {
       cur = nt::left(cur);
       ++level;
     } else {
       while (cur != nullptr) {
-        in(nt::key(cur), level);
+        if (nt::live(cur))
+          in(nt::key(cur), level);
         if (nt::right(cur) != nullptr) {
           cur = nt::right(cur);
           ++level;
           break;
         } else {
-          post(nt::key(cur), level);
+          if (nt::live(cur))
+            post(nt::key(cur), level);
           auto parent = nt::parent(cur);
           while (parent != nullptr && nt::left(parent)!= cur) {
             cur = parent;
             --level;
-            post(nt::key(cur), level);
+            if (nt::live(cur))
+              post(nt::key(cur), level);
             parent = nt::parent(cur);
           }
           cur = nt::parent(cur);
@@ -153,113 +252,326 @@ void postorder_traverse(const Tree& tree, Callback cb)
   traverse(tree, dummy, dummy, cb);
 }
 
+// Breadth-first walk calling callback(key, level). The buffer holds the
+// visited nodes and is only grown, so passing the same one to repeated calls
+// avoids allocation altogether.
 template<class Tree, typename Callback>
-void level_order_traverse(const Tree& tree, Callback callback)
+void level_order_traverse(const Tree& tree, Callback callback,
+    std::vector<const typename Tree::node_type*>& buffer)
 {
   using node_type = typename Tree::node_type;
   using nt = node_traits<node_type>;
-  std::queue<std::pair<const node_type*, unsigned>> q;
-  q.push(std::make_pair(tree.croot(), 1u));
-  while (!q.empty()) {
-    auto f = q.front(); q.pop();
-    auto n = f.first;
-    auto level = f.second;
-
-    callback(nt::key(n), level);
-
-    auto left = nt::left(n);
-    if (left != nullptr) {
-      q.push(std::make_pair(left, level + 1u));
-    }
-    auto right = nt::right(n);
-    if (right != nullptr) {
-      q.push(std::make_pair(right, level + 1u));
+  buffer.clear();
+  if (tree.croot() == nullptr)
+    return;
+  buffer.push_back(tree.croot());
+  std::size_t begin = 0;
+  for (unsigned level = 1u; begin < buffer.size(); ++level) {
+    const std::size_t end = buffer.size();
+    for (std::size_t i = begin; i < end; ++i) {
+      auto n = buffer[i];
+      if (nt::live(n))
+        callback(nt::key(n), level);
+
+      auto left = nt::left(n);
+      if (left != nullptr)
+        buffer.push_back(left);
+      auto right = nt::right(n);
+      if (right != nullptr)
+        buffer.push_back(right);
     }
+    begin = end;
   }
 }
 
+template<class Tree, typename Callback>
+void level_order_traverse(const Tree& tree, Callback callback)
+{
+  std::vector<const typename Tree::node_type*> buffer;
+  buffer.reserve(tree.size());
+  level_order_traverse(tree, callback, buffer);
+}
+
+// Follows the heavier child, O(height).
+template<class Tree>
+int tree_height(const Tree& tree, std::true_type)
+{
+  using nt = node_traits<typename Tree::node_type>;
+  auto n = tree.croot();
+  int h = 0;
+  for (; n != nullptr; ++h)
+    n = nt::balance(n) > 0 ? nt::right(n) : nt::left(n);
+  return h;
+}
+
+template<class Tree>
+int tree_height(const Tree& tree, std::false_type)
+{
+  unsigned h = 0;
+  level_order_traverse(tree, [&](const typename node_traits<typename Tree::node_type>::value_type&, unsigned level) {
+    h = level;
+  });
+  return (int)h;
+}
+
+// Uses the stored balance factors when the node has them, O(n) otherwise.
 template<class Tree>
 int tree_height(const Tree& tree)
+{
+  using nt = node_traits<typename Tree::node_type>;
+  using balanced = std::integral_constant<bool, nt::has_balance>;
+  return tree_height(tree, balanced());
+}
+
+template<typename T>
+typename std::enable_if<std::is_integral<T>::value, std::string>::type to_text(const T& v)
+{ return std::to_string(v); }
+
+inline std::string to_text(const std::string& v)
+{ return v; }
+
+template<typename T>
+typename std::enable_if<!std::is_integral<T>::value, std::string>::type to_text(const T& v)
+{
+  std::ostringstream os;
+  os << v;
+  return os.str();
+}
+
+// Collects output in a string and hands it to the stream in large chunks.
+class buffered_writer
+{
+public:
+  explicit buffered_writer(std::ostream& os, std::size_t capacity = 1u << 16)
+    : _os(os), _capacity(capacity)
+  { _buf.reserve(capacity); }
+
+  ~buffered_writer()
+  { flush(); }
+
+  buffered_writer& operator<<(const std::string& s)
+  {
+    _buf += s;
+    if (_buf.size() >= _capacity)
+      flush();
+    return *this;
+  }
+
+  buffered_writer& operator<<(const char* s)
+  {
+    _buf += s;
+    if (_buf.size() >= _capacity)
+      flush();
+    return *this;
+  }
+
+  buffered_writer& operator<<(char c)
+  {
+    _buf += c;
+    return *this;
+  }
+
+  buffered_writer& indent(std::size_t n)
+  {
+    _buf.append(n, ' ');
+    return *this;
+  }
+
+  template<typename T>
+  buffered_writer& operator<<(const T& v)
+  { return *this << to_text(v); }
+
+  void flush()
+  {
+    _os.write(_buf.data(), _buf.size());
+    _buf.clear();
+  }
+
+private:
+  std::ostream& _os;
+  std::size_t _capacity;
+  std::string _buf;
+};
+
+template<class Node>
+std::string balance_text(const Node* n, std::true_type)
+{
+  int b = node_traits<Node>::balance(n);
+  return "(" + std::string(b > 0 ? "+" : "") + std::to_string(b) + ")";
+}
+
+template<class Node>
+std::string balance_text(const Node*, std::false_type)
+{ return std::string(); }
+
+template<class Node>
+struct dump_entry
+{
+  const Node* node;
+  unsigned level;
+  std::size_t parent_id;
+  char side; // 'L', 'R' or ' ' for the root
+  bool children_cut;
+};
+
+// Pre-order walk over at most max_nodes nodes no deeper than max_depth,
+// calling visit(entry, id) with ids assigned in visiting order.
+// Returns false if the node cap cut the walk short.
+template<class Tree, typename Visit>
+bool capped_preorder(const Tree& tree, unsigned max_depth, std::size_t max_nodes, Visit visit)
 {
   using node_type = typename Tree::node_type;
   using nt = node_traits<node_type>;
-  struct helper
-  {
-    // -1 not an avl tree, 0+ heights of a tree under root
-    int depth(const node_type* root)
-    {
-      if (root == nullptr)
-        return 0;
-      auto lh = depth(nt::left(root));
-      auto rh = depth(nt::right(root));
-      return 1 + std::max(lh, rh);
+  std::vector<dump_entry<node_type>> stack;
+  if (tree.croot() != nullptr && max_depth > 0)
+    stack.push_back({tree.croot(), 1u, 0, ' ', false});
+  std::size_t id = 0;
+  while (!stack.empty()) {
+    if (id == max_nodes)
+      return false;
+    auto e = stack.back();
+    stack.pop_back();
+    auto left = nt::left(e.node);
+    auto right = nt::right(e.node);
+    e.children_cut = e.level == max_depth && (left != nullptr || right != nullptr);
+    visit(e, id);
+    if (e.level < max_depth) {
+      if (right != nullptr)
+        stack.push_back({right, e.level + 1, id, 'R', false});
+      if (left != nullptr)
+        stack.push_back({left, e.level + 1, id, 'L', false});
     }
-  };
+    ++id;
+  }
+  return true;
+}
 
-  helper h;
-  return h.depth(tree.croot());
+// Streams one node per line in pre-order, indented by level:
+//   key(balance)
+//     L key(balance)
+//     R key(balance) ...
+// A trailing "..." marks children below max_depth. O(n) time, O(height) memory.
+template<class Tree>
+void dump_tree(const Tree& tree, std::ostream& os,
+    unsigned max_depth = std::numeric_limits<unsigned>::max(),
+    std::size_t max_nodes = std::numeric_limits<std::size_t>::max())
+{
+  using node_type = typename Tree::node_type;
+  using nt = node_traits<node_type>;
+  using balanced = std::integral_constant<bool, nt::has_balance>;
+
+  buffered_writer out(os);
+  bool complete = capped_preorder(tree, max_depth, max_nodes, [&](const dump_entry<node_type>& e, std::size_t) {
+    out.indent(2 * (e.level - 1));
+    if (e.side != ' ')
+      out << e.side << ' ';
+    out << nt::key(e.node) << balance_text(e.node, balanced());
+    if (e.children_cut)
+      out << " ...";
+    out << '\n';
+  });
+  if (!complete)
+    out << "... stopped after " << max_nodes << " nodes\n";
+}
+
+inline std::string dot_escape(const std::string& s)
+{
+  std::string r;
+  r.reserve(s.size());
+  for (char c : s) {
+    if (c == '"' || c == '\\')
+      r += '\\';
+    r += c;
+  }
+  return r;
 }
 
+// Writes the tree as a Graphviz digraph, labelling nodes with key and
+// balance factor. Missing left/right children of inner nodes are drawn as
+// points so the shape of the tree is preserved.
 template<class Tree>
-void print_tree(const Tree& tree, std::ostream& os)
+void write_dot(const Tree& tree, std::ostream& os,
+    unsigned max_depth = std::numeric_limits<unsigned>::max(),
+    std::size_t max_nodes = std::numeric_limits<std::size_t>::max())
 {
-  if (tree.size() == 0)
-    return;
+  using node_type = typename Tree::node_type;
+  using nt = node_traits<node_type>;
+  using balanced = std::integral_constant<bool, nt::has_balance>;
 
-  const int total_levels = tree_height(tree) - 1;
-  std::cout << "Total levels " << total_levels << std::endl;
+  buffered_writer out(os);
+  out << "digraph tree {\n  node [shape=ellipse];\n";
+  capped_preorder(tree, max_depth, max_nodes, [&](const dump_entry<node_type>& e, std::size_t id) {
+    out << "  n" << id << " [label=\""
+        << dot_escape(to_text(nt::key(e.node)) + balance_text(e.node, balanced())) << "\"];\n";
+    if (e.side != ' ')
+      out << "  n" << e.parent_id << " -> n" << id << ";\n";
+    if (e.children_cut) {
+      out << "  n" << id << "_cut [shape=plaintext, label=\"...\"];\n"
+          << "  n" << id << " -> n" << id << "_cut;\n";
+    } else if ((nt::left(e.node) == nullptr) != (nt::right(e.node) == nullptr)) {
+      const char* missing = nt::left(e.node) == nullptr ? "L" : "R";
+      out << "  n" << id << missing << " [shape=point];\n"
+          << "  n" << id << " -> n" << id << missing << ";\n";
+    }
+  });
+  out << "}\n";
+}
 
+// Draws the tree level by level, each node centered over its children.
+// The picture doubles in width with every level, so this is meant for small
+// trees; use dump_tree or write_dot for big ones.
+template<class Tree>
+void print_tree(const Tree& tree, std::ostream& os,
+    unsigned max_depth = std::numeric_limits<unsigned>::max())
+{
   using node_type = typename Tree::node_type;
   using nt = node_traits<node_type>;
-  std::queue<std::pair<const node_type*, unsigned>> q;
-  q.push(std::make_pair(tree.croot(), 0u));
-  unsigned cur_lev = 0;
+  using balanced = std::integral_constant<bool, nt::has_balance>;
+  if (tree.croot() == nullptr || max_depth == 0)
+    return;
 
-  std::map<const node_type*, int> parents_pos;
-  std::map<const node_type*, int> cur_lvl_pos;
-  int print_pos = 0;
-  while (!q.empty()) {
-    auto f = q.front(); q.pop();
-    auto n = f.first;
-    auto level = f.second;
-    if (level != cur_lev) {
-      os << std::endl;
-      cur_lev = level;
-      parents_pos.swap(cur_lvl_pos);
-      cur_lvl_pos.clear();
+  const unsigned total_levels = std::min<unsigned>(tree_height(tree), max_depth) - 1;
+  buffered_writer out(os);
+  out << "Total levels " << total_levels << '\n';
+
+  struct entry
+  {
+    const node_type* node;
+    unsigned level;
+    std::size_t position; // left to right among the 2^level slots
+  };
+  std::vector<entry> q;
+  q.push_back({tree.croot(), 0u, 0});
+  unsigned cur_lev = 0;
+  std::size_t print_pos = 0;
+  for (std::size_t i = 0; i < q.size(); ++i) {
+    auto e = q[i];
+    if (e.level != cur_lev) {
+      out << '\n';
+      cur_lev = e.level;
       print_pos = 0;
     }
-    auto pn = nt::parent(n);
-    auto it = parents_pos.find(pn);
-    int position;
-    if (it != parents_pos.end()) {
-      int pnpos = it->second;
-      position = 2 * pnpos + (nt::left(pn) == n ? 0 : 1);
-    } else {
-      position = 0;
-    }
-    cur_lvl_pos.insert(std::make_pair(n, position));
-    // print
-    const int num_chars_per_node = 11 + 1; // chars per int + 1
-    const int block_size = (int)std::pow(2, total_levels-level) * num_chars_per_node;
-    int start_print = position * block_size + (block_size - num_chars_per_node) / 2;
-
-    auto val_str = std::to_string(nt::key(n)) + "(" + std::to_string(n->balance) + ")";
-    int prefix_size = start_print - print_pos + num_chars_per_node - val_str.length();
-    if (prefix_size <= 0)
-      prefix_size = 1;
-    os << std::string(prefix_size, ' ') << val_str;
-    print_pos = start_print + num_chars_per_node;
-
-    auto left = nt::left(n);
-    if (left != nullptr) {
-      q.push(std::make_pair(left, level + 1u));
-    }
-    auto right = nt::right(n);
-    if (right != nullptr) {
-      q.push(std::make_pair(right, level + 1u));
-    }
+    const std::size_t num_chars_per_node = 11 + 1; // chars per int + 1
+    const std::size_t block_size = (std::size_t(1) << (total_levels - e.level)) * num_chars_per_node;
+    std::size_t start_print = e.position * block_size + (block_size - num_chars_per_node) / 2;
+
+    auto val_str = to_text(nt::key(e.node)) + balance_text(e.node, balanced());
+    std::size_t end_print = start_print + num_chars_per_node;
+    std::size_t prefix_size = end_print > print_pos + val_str.length()
+        ? end_print - print_pos - val_str.length() : 1;
+    out.indent(prefix_size) << val_str;
+    print_pos = end_print;
+
+    if (e.level == total_levels)
+      continue;
+    auto left = nt::left(e.node);
+    if (left != nullptr)
+      q.push_back({left, e.level + 1u, 2 * e.position});
+    auto right = nt::right(e.node);
+    if (right != nullptr)
+      q.push_back({right, e.level + 1u, 2 * e.position + 1});
   }
+  out << '\n';
 }
 
 }
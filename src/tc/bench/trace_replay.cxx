@@ -0,0 +1,206 @@
+// Replays a recorded operation trace (tc/trace.h) against several tree
+// variants and reports per-operation latency percentiles and throughput.
+//
+//   trace_replay <trace>
+//   trace_replay --generate <trace> [ops]   writes a synthetic int trace
+//
+// The trace is memory-mapped. Each variant replays it twice: once timing
+// every operation on its own (latency, includes clock overhead of some tens
+// of nanoseconds) and once untimed (throughput).
+
+#include "tc/avl_tree.h"
+#include "tc/btree.h"
+#include "tc/trace.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+volatile std::size_t sink;
+
+// Log-linear histogram of nanosecond latencies: 32 linear sub-buckets per
+// power of two, so a percentile is off by at most about 3%.
+class latency_histogram
+{
+public:
+  static const unsigned sub_bits = 5;
+
+  latency_histogram() : _buckets(64 << sub_bits), _count(0) { }
+
+  void add(std::uint64_t ns)
+  {
+    ++_buckets[index(ns)];
+    ++_count;
+  }
+
+  std::uint64_t count() const { return _count; }
+
+  // Smallest latency not exceeded by a fraction q of the samples.
+  std::uint64_t percentile(double q) const
+  {
+    const std::uint64_t rank = static_cast<std::uint64_t>(q * (_count - 1));
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < _buckets.size(); ++i) {
+      seen += _buckets[i];
+      if (seen > rank)
+        return upper(i);
+    }
+    return 0;
+  }
+
+private:
+  static std::size_t index(std::uint64_t v)
+  {
+    if (v < (1u << sub_bits))
+      return v;
+    unsigned msb = 63 - __builtin_clzll(v);
+    unsigned shift = msb - sub_bits;
+    return ((shift + 1) << sub_bits) + ((v >> shift) & ((1u << sub_bits) - 1));
+  }
+
+  static std::uint64_t upper(std::size_t i)
+  {
+    if (i < (1u << sub_bits))
+      return i;
+    unsigned shift = (i >> sub_bits) - 1;
+    std::uint64_t sub = i & ((1u << sub_bits) - 1);
+    return (((1ull << sub_bits) + sub + 1) << shift) - 1;
+  }
+
+  std::vector<std::uint64_t> _buckets;
+  std::uint64_t _count;
+};
+
+template<typename T>
+struct std_set
+{
+  std::set<T> s;
+  void insert(const T& v) { s.insert(v); }
+  void erase(const T& v) { s.erase(v); }
+  bool contains(const T& v) const { return s.count(v) != 0; }
+};
+
+const char* op_names[] = {"insert", "erase", "lookup"};
+
+template<class Tree, typename T>
+void run(const char* name, const tc::trace_view<T>& trace)
+{
+  latency_histogram hist[3];
+  {
+    Tree tree;
+    std::size_t found = 0;
+    for (std::size_t i = 0; i < trace.size(); ++i) {
+      const tc::trace_op op = trace.op(i);
+      const T key = trace.key(i);
+      auto start = std::chrono::steady_clock::now();
+      switch (op) {
+      case tc::trace_op::insert: tree.insert(key); break;
+      case tc::trace_op::erase: tree.erase(key); break;
+      case tc::trace_op::lookup: found += tree.contains(key); break;
+      }
+      auto end = std::chrono::steady_clock::now();
+      hist[static_cast<unsigned>(op)].add(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+    }
+    sink = found;
+  }
+
+  double seconds;
+  {
+    Tree tree;
+    auto start = std::chrono::steady_clock::now();
+    sink = tc::replay(trace, tree);
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  std::printf("%-10s %12.0f ops/s\n", name, trace.size() / seconds);
+  for (unsigned op = 0; op < 3; ++op) {
+    if (hist[op].count() == 0)
+      continue;
+    std::printf("  %-8s %10llu ops  p50 %6llu ns  p99 %6llu ns  p999 %6llu ns\n", op_names[op],
+        (unsigned long long)hist[op].count(),
+        (unsigned long long)hist[op].percentile(0.5),
+        (unsigned long long)hist[op].percentile(0.99),
+        (unsigned long long)hist[op].percentile(0.999));
+  }
+}
+
+template<typename T>
+void run_all(const void* data, std::size_t bytes)
+{
+  tc::trace_view<T> trace(data, bytes);
+  std::printf("%zu operations, %zu byte keys\n", trace.size(), sizeof(T));
+  run<tc::avl_tree<T>>("avl_tree", trace);
+  run<tc::btree<T>>("btree", trace);
+  run<std_set<T>>("std::set", trace);
+}
+
+// Mixed workload: a growing key space with 60% lookups, 25% inserts and 15% erases.
+int generate(const char* path, std::size_t ops)
+{
+  std::ofstream os(path, std::ios::binary);
+  if (!os)
+    throw std::runtime_error(std::string("cannot create ") + path);
+  tc::trace_writer<std::int32_t> writer(os);
+  std::mt19937 rng(42);
+  for (std::size_t i = 0; i < ops; ++i) {
+    std::int32_t key = static_cast<std::int32_t>(rng() % (i / 2 + 16));
+    unsigned r = rng() % 100;
+    writer.record(r < 60 ? tc::trace_op::lookup : r < 85 ? tc::trace_op::insert : tc::trace_op::erase, key);
+  }
+  writer.flush();
+  return os ? 0 : 1;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+  try {
+    if (argc >= 3 && std::strcmp(argv[1], "--generate") == 0)
+      return generate(argv[2], argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 1000000);
+    if (argc != 2) {
+      std::fprintf(stderr, "usage: %s <trace> | --generate <trace> [ops]\n", argv[0]);
+      return 2;
+    }
+
+    int fd = ::open(argv[1], O_RDONLY);
+    if (fd < 0)
+      throw std::runtime_error(std::string("cannot open ") + argv[1]);
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || st.st_size == 0)
+      throw std::runtime_error(std::string("cannot read ") + argv[1]);
+    const std::size_t bytes = st.st_size;
+    void* data = ::mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+      throw std::runtime_error(std::string("cannot map ") + argv[1]);
+    ::madvise(data, bytes, MADV_SEQUENTIAL);
+
+    switch (tc::trace_view<std::int32_t>::key_size(data, bytes)) {
+    case 4: run_all<std::int32_t>(data, bytes); break;
+    case 8: run_all<std::int64_t>(data, bytes); break;
+    default: throw std::runtime_error("only 4 and 8 byte integer keys can be replayed");
+    }
+    ::munmap(data, bytes);
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,269 @@
+// Compares tc::avl_tree, tc::btree and std::set on the same workloads.
+//
+//   tree_bench [keys]
+//
+// Prints nanoseconds per operation for each container and workload, then,
+// where hardware counters are available, cycles, instructions, cache and
+// branch misses per operation.
+
+#include "tc/avl_map.h"
+#include "tc/avl_tree.h"
+#include "tc/btree.h"
+#include "tc/perf_counters.h"
+#include "tc/small_set.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+volatile std::size_t sink;
+
+tc::perf_counters counters;
+
+struct counted_run
+{
+  std::string label;
+  tc::perf_sample sample;
+  std::size_t ops;
+};
+
+std::vector<counted_run> counted;
+
+template<typename F>
+double ns_per_op(const std::string& label, std::size_t ops, F f)
+{
+  tc::perf_sample sample;
+  {
+    tc::perf_scope scope(counters, sample);
+    f();
+  }
+  counted.push_back({label, sample, ops});
+  return sample.seconds * 1e9 / ops;
+}
+
+// A key dragging a payload along, as a map emulated with a set would store it.
+struct fat_record
+{
+  int id;
+  char payload[120];
+
+  bool operator<(const fat_record& o) const { return id < o.id; }
+};
+
+struct workload
+{
+  std::vector<int> keys;    // distinct, shuffled
+  std::vector<int> sorted;
+  std::vector<int> misses;  // keys not in the set
+};
+
+template<typename Set>
+void run(const char* name, const workload& w, std::function<void(Set&, int)> add, std::function<bool(const Set&, int)> has)
+{
+  const std::size_t n = w.keys.size();
+  const std::string prefix = std::string(name) + " ";
+  double random_insert, sorted_insert, hit, miss, erase;
+  {
+    Set s;
+    random_insert = ns_per_op(prefix + "random insert", n, [&] { for (int k : w.keys) add(s, k); });
+    hit = ns_per_op(prefix + "hit", n, [&] {
+      std::size_t found = 0;
+      for (int k : w.keys) found += has(s, k);
+      sink = found;
+    });
+    miss = ns_per_op(prefix + "miss", n, [&] {
+      std::size_t found = 0;
+      for (int k : w.misses) found += has(s, k);
+      sink = found;
+    });
+    erase = ns_per_op(prefix + "erase", n / 2, [&] { for (std::size_t i = 0; i < n / 2; ++i) s.erase(w.keys[i]); });
+  }
+  {
+    Set s;
+    sorted_insert = ns_per_op(prefix + "sorted insert", n, [&] { for (int k : w.sorted) add(s, k); });
+  }
+  std::printf("%-14s %14.1f %14.1f %10.1f %10.1f %10.1f\n", name, random_insert, sorted_insert, hit, miss, erase);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+  const std::size_t n = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+
+  workload w;
+  std::mt19937 rng(42);
+  for (std::size_t i = 0; i < n; ++i) {
+    w.keys.push_back(int(2 * i));
+    w.misses.push_back(int(2 * i + 1));
+  }
+  w.sorted = w.keys;
+  std::shuffle(w.keys.begin(), w.keys.end(), rng);
+  std::shuffle(w.misses.begin(), w.misses.end(), rng);
+
+  std::printf("%zu keys, ns per operation\n", n);
+  std::printf("%-14s %14s %14s %10s %10s %10s\n", "", "random insert", "sorted insert", "hit", "miss", "erase");
+
+  run<tc::avl_tree<int>>("avl_tree", w,
+      [](tc::avl_tree<int>& s, int k) { s.insert(k); },
+      [](const tc::avl_tree<int>& s, int k) { return s.contains(k); });
+  using lazy_tree = tc::avl_tree<int, std::less<int>, tc::avl_lazy_policy>;
+  run<lazy_tree>("avl_tree/lazy", w,
+      [](lazy_tree& s, int k) { s.insert(k); },
+      [](const lazy_tree& s, int k) { return s.contains(k); });
+  run<tc::btree<int>>("btree", w,
+      [](tc::btree<int>& s, int k) { s.insert(k); },
+      [](const tc::btree<int>& s, int k) { return s.contains(k); });
+  run<tc::btree<int, std::less<int>, 4096>>("btree/4k", w,
+      [](tc::btree<int, std::less<int>, 4096>& s, int k) { s.insert(k); },
+      [](const tc::btree<int, std::less<int>, 4096>& s, int k) { return s.contains(k); });
+  run<std::set<int>>("std::set", w,
+      [](std::set<int>& s, int k) { s.insert(k); },
+      [](const std::set<int>& s, int k) { return s.count(k) != 0; });
+
+  {
+    // Lookups in groups of 64 keys, as a request handler would issue them.
+    tc::avl_tree<int> s;
+    for (int k : w.keys)
+      s.insert(k);
+    const std::size_t group = 64;
+    std::vector<const tc::avl_tree<int>::node_type*> found(group);
+    double single = ns_per_op("avl_tree hit loop", n, [&] {
+      std::size_t hits = 0;
+      for (std::size_t at = 0; at + group <= n; at += group)
+        for (std::size_t i = 0; i < group; ++i)
+          hits += s.find(w.keys[at + i]) != nullptr;
+      sink = hits;
+    });
+    double batched = ns_per_op("avl_tree hit find_batch", n, [&] {
+      std::size_t hits = 0;
+      for (std::size_t at = 0; at + group <= n; at += group) {
+        s.find_batch(w.keys.data() + at, group, found.data());
+        for (auto f : found)
+          hits += f != nullptr;
+      }
+      sink = hits;
+    });
+    std::printf("avl_tree hits in groups of %zu: loop %.1f ns, find_batch %.1f ns per key\n", group, single, batched);
+  }
+
+  {
+    // Probes mixing hits and misses, with and without a negative-lookup filter.
+    tc::avl_tree<int> plain;
+    tc::avl_tree<int, std::less<int>, tc::avl_filter_policy> filtered;
+    for (int k : w.keys) {
+      plain.insert(k);
+      filtered.insert(k);
+    }
+    std::printf("avl_tree probes, ns per key (filter false positive rate):\n");
+    for (unsigned hit_percent : {0u, 50u, 90u, 100u}) {
+      std::vector<int> probes(n);
+      std::mt19937 pick(hit_percent);
+      for (std::size_t i = 0; i < n; ++i)
+        probes[i] = pick() % 100 < hit_percent ? w.keys[i] : w.misses[i];
+      const auto before = filtered.filter_stats();
+      double without = ns_per_op("avl_tree probes", n, [&] {
+        std::size_t hits = 0;
+        for (int k : probes) hits += plain.contains(k);
+        sink = hits;
+      });
+      double with = ns_per_op("avl_tree+filter probes", n, [&] {
+        std::size_t hits = 0;
+        for (int k : probes) hits += filtered.contains(k);
+        sink = hits;
+      });
+      const auto after = filtered.filter_stats();
+      const double misses = double(after.negatives - before.negatives + after.false_positives - before.false_positives);
+      std::printf("  %3u%% hits: plain %.1f, filtered %.1f (%.2f%%)\n", hit_percent, without, with,
+          misses ? 100.0 * (after.false_positives - before.false_positives) / misses : 0.0);
+    }
+  }
+
+  {
+    // The long tail: many sets of a dozen keys each.
+    const std::size_t per_set = 12, sets = n / per_set;
+    std::vector<tc::avl_tree<int>> trees(sets);
+    std::vector<tc::small_set<int, 16>> smalls(sets);
+    double tree_build = ns_per_op("tiny avl_tree insert", sets * per_set, [&] {
+      for (std::size_t i = 0; i < sets * per_set; ++i)
+        trees[i / per_set].insert(w.keys[i]);
+    });
+    double small_build = ns_per_op("tiny small_set insert", sets * per_set, [&] {
+      for (std::size_t i = 0; i < sets * per_set; ++i)
+        smalls[i / per_set].insert(w.keys[i]);
+    });
+    double tree_hit = ns_per_op("tiny avl_tree hit", sets * per_set, [&] {
+      std::size_t hits = 0;
+      for (std::size_t i = 0; i < sets * per_set; ++i)
+        hits += trees[i / per_set].contains(w.keys[i]);
+      sink = hits;
+    });
+    double small_hit = ns_per_op("tiny small_set hit", sets * per_set, [&] {
+      std::size_t hits = 0;
+      for (std::size_t i = 0; i < sets * per_set; ++i)
+        hits += smalls[i / per_set].contains(w.keys[i]);
+      sink = hits;
+    });
+    std::printf("%zu sets of %zu keys: avl_tree insert %.1f, hit %.1f ns, %zu bytes per set; "
+        "small_set insert %.1f, hit %.1f ns, %zu bytes per set\n", sets, per_set,
+        tree_build, tree_hit, sizeof(tc::avl_tree<int>) + per_set * sizeof(tc::avl_tree<int>::node_type),
+        small_build, small_hit, sizeof(tc::small_set<int, 16>));
+  }
+
+  {
+    // Payload in the node versus out of line in an avl_map.
+    tc::avl_tree<fat_record> fat;
+    tc::avl_map<int, fat_record> map;
+    fat_record r = {};
+    for (int k : w.keys) {
+      r.id = k;
+      fat.insert(r);
+      map.insert_or_assign(k, r);
+    }
+    double in_node = ns_per_op("avl_tree<fat_record> hit", n, [&] {
+      std::size_t sum = 0;
+      fat_record probe = {};
+      for (int k : w.keys) {
+        probe.id = k;
+        sum += fat.find(probe)->key.payload[0];
+      }
+      sink = sum;
+    });
+    double out_of_line = ns_per_op("avl_map<int, fat_record> hit", n, [&] {
+      std::size_t sum = 0;
+      for (int k : w.keys)
+        sum += map.find(k)->payload[0];
+      sink = sum;
+    });
+    std::printf("%zu byte payload: in avl_tree nodes %.1f ns, in avl_map values %.1f ns per hit\n",
+        sizeof(r.payload), in_node, out_of_line);
+  }
+
+  double bulk = ns_per_op("btree bulk load", n, [&] {
+    tc::btree<int> s(w.sorted.begin(), w.sorted.end());
+    sink = s.size();
+  });
+  std::printf("btree bulk load: %.1f ns per key\n", bulk);
+
+  if (!counters.available()) {
+    std::printf("hardware counters unavailable, timing only\n");
+    return 0;
+  }
+  std::fflush(stdout);
+  for (const auto& r : counted) {
+    std::cout << r.label << ": ";
+    tc::write_per_op(std::cout, r.sample, r.ops);
+    std::cout << "\n";
+  }
+  return 0;
+}
@@ -0,0 +1,162 @@
+#include "tc/avl_map.h"
+#include "tc/tree.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace
+{
+
+struct checked_stats_policy : tc::avl_checked_policy
+{
+  using stats_type = tc::avl_counting_stats;
+};
+
+using checked_map = tc::avl_map<int, std::string, std::less<int>, checked_stats_policy>;
+using entry_list = std::vector<std::pair<int, std::string>>;
+
+template<class Map>
+entry_list entries(const Map& m)
+{
+  entry_list r;
+  m.for_each([&](int k, const std::string& v) { r.emplace_back(k, v); });
+  return r;
+}
+
+}
+
+TEST(avl_map_test, test_basics)
+{
+  checked_map subj {};
+  EXPECT_TRUE(subj.empty());
+  subj[3] = "three";
+  subj[1] = "one";
+  EXPECT_TRUE(subj.insert_or_assign(2, "two"));
+  EXPECT_FALSE(subj.insert_or_assign(3, "THREE"));
+  EXPECT_EQ(3u, subj.size());
+  EXPECT_EQ("THREE", subj[3]);
+  EXPECT_EQ("", subj[4]); // value-initialized
+  EXPECT_EQ(4u, subj.size());
+
+  ASSERT_NE(nullptr, subj.find(1));
+  EXPECT_EQ("one", *subj.find(1));
+  EXPECT_EQ(nullptr, subj.find(5));
+  EXPECT_EQ("two", subj.at(2));
+  EXPECT_THROW(subj.at(5), std::out_of_range);
+  EXPECT_TRUE(subj.contains(4));
+
+  EXPECT_TRUE(subj.erase(1));
+  EXPECT_FALSE(subj.erase(1));
+  EXPECT_EQ((entry_list{{2, "two"}, {3, "THREE"}, {4, ""}}), entries(subj));
+  EXPECT_TRUE(tc::is_avl_tree(subj.keys()));
+}
+
+TEST(avl_map_test, test_values_do_not_touch_the_tree)
+{
+  checked_map subj {};
+  for (int i = 0; i < 100; ++i)
+    subj[i] = std::to_string(i);
+  subj.keys().contains(0);
+  const auto before = subj.keys().stats();
+  // A found value is read and written without another descent.
+  std::string* v = subj.find(42);
+  ASSERT_NE(nullptr, v);
+  *v += "!";
+  EXPECT_EQ(before.lookups + 1, subj.keys().stats().lookups);
+  EXPECT_EQ(before.inserts, subj.keys().stats().inserts);
+  EXPECT_EQ("42!", subj.at(42));
+}
+
+TEST(avl_map_test, test_assign_existing_key_only_searches)
+{
+  checked_map subj {};
+  for (int i = 0; i < 100; ++i)
+    subj[i] = std::to_string(i);
+  const auto node = subj.keys().find(42);
+  const auto before = subj.keys().stats();
+  subj[42] = "x";
+  EXPECT_FALSE(subj.insert_or_assign(42, "y"));
+  const auto after = subj.keys().stats();
+  EXPECT_EQ(node, subj.keys().find(42));
+  EXPECT_EQ(100u, subj.size());
+  EXPECT_EQ(before.inserts, after.inserts);
+  EXPECT_EQ(before.allocations, after.allocations);
+  EXPECT_EQ(before.lookups + 2, after.lookups);
+  EXPECT_EQ("y", subj.at(42));
+}
+
+TEST(avl_map_test, test_random_sequence)
+{
+  checked_map subj {};
+  std::map<int, std::string> model;
+  std::srand(67);
+  for (int i = 0; i < 20000; ++i) {
+    int k = std::rand() % 500;
+    switch (std::rand() % 4) {
+    case 0:
+      subj[k] += "a";
+      model[k] += "a";
+      break;
+    case 1:
+      ASSERT_EQ(model.count(k) == 0, subj.insert_or_assign(k, std::to_string(i)));
+      model[k] = std::to_string(i);
+      break;
+    case 2:
+      ASSERT_EQ(model.erase(k) != 0, subj.erase(k));
+      break;
+    default: {
+      auto it = model.find(k);
+      auto v = subj.find(k);
+      ASSERT_EQ(it != model.end(), v != nullptr);
+      if (v) {
+        ASSERT_EQ(it->second, *v);
+      }
+    }
+    }
+    ASSERT_EQ(model.size(), subj.size());
+  }
+  EXPECT_EQ(entry_list(model.begin(), model.end()), entries(subj));
+
+  // Copies own their values and owners; changes do not leak between them.
+  auto copy = subj;
+  EXPECT_EQ(entries(subj), entries(copy));
+  for (int k = 0; k < 500; k += 2)
+    copy.erase(k);
+  copy[1] = "changed";
+  EXPECT_EQ(entry_list(model.begin(), model.end()), entries(subj));
+  for (int k = 1; k < 500; k += 2) {
+    auto it = model.find(k);
+    if (k == 1) {
+      EXPECT_EQ("changed", copy.at(1));
+    } else {
+      EXPECT_EQ(it != model.end(), copy.contains(k));
+    }
+  }
+}
+
+TEST(avl_map_test, test_move_only_values)
+{
+  tc::avl_map<std::string, std::unique_ptr<int>> subj {};
+  subj.insert_or_assign("b", std::unique_ptr<int>(new int(2)));
+  subj["a"].reset(new int(1));
+  subj.insert_or_assign("c", std::unique_ptr<int>(new int(3)));
+  EXPECT_TRUE(subj.erase("a"));
+  EXPECT_EQ(2, *subj.at("b"));
+  EXPECT_EQ(3, *subj.at("c"));
+
+  decltype(subj) other;
+  swap(subj, other);
+  EXPECT_TRUE(subj.empty());
+  EXPECT_EQ(2u, other.size());
+  subj = std::move(other);
+  EXPECT_EQ(3, *subj.at("c"));
+  subj.clear();
+  EXPECT_TRUE(subj.empty());
+  EXPECT_EQ(nullptr, subj.find("b"));
+}
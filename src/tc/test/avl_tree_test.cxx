@@ -1,9 +1,17 @@
 #include "tc/avl_tree.h"
+#include "tc/trace.h"
 #include "tc/tree.h"
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
 #include <chrono>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
 #include <vector>
 #include <iostream>
 
@@ -68,28 +76,23 @@ TEST(avl_tree_test, test_monotonic_sequence)
 
 TEST(avl_tree_test, test_random_sequence)
 {
-  using namespace std::chrono;
-  auto ms = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
-  std::srand(ms);
+	using namespace std::chrono;
+	auto seed = static_cast<unsigned>(duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count());
+	std::srand(seed);
+	SCOPED_TRACE("seed " + std::to_string(seed));
 
-  tc::avl_tree<int> subj {};
-	std::string items;
-	items.reserve(2048 *	16);
-	try
-	{
-		for (int i = 0; i < 1777; ++i) {
-			int x = rand();
-			items += std::to_string(x) + ", ";
-			subj.insert(x);
-			ASSERT_TRUE(tc::is_avl_tree(subj)) << "With following input: " << items;
-		}
+	// On failure the inserts are saved as a trace for trace_replay or a debugger.
+	std::ostringstream trace;
+	tc::trace_writer<int> writer(trace);
+	tc::traced_tree<tc::avl_tree<int>> subj(&writer);
+	for (int i = 0; i < 1777 && !HasFailure(); ++i) {
+		subj.insert(rand());
+		EXPECT_TRUE(tc::is_avl_tree(subj.tree())) << "after " << (i + 1) << " inserts";
 	}
-	catch (...)
-	{
-		std::cout << "Exception caught with following input: " << items << std::endl;
-		throw;
+	if (HasFailure()) {
+		writer.flush();
+		std::ofstream("avl_tree_test_random_sequence.trace", std::ios::binary) << trace.str();
 	}
-  //tc::print_tree(subj, std::cout);
 }
 
 TEST(avl_tree_test, test_erase)
@@ -120,3 +123,796 @@ TEST(avl_tree_test, test_erase)
 			EXPECT_EQ(std::vector<unsigned>({1, 2, 2, 3}), lvl_trace);
 	}
 }
+
+TEST(avl_tree_test, test_erase_rebalances)
+{
+	tc::avl_tree<int, std::less<int>, tc::avl_checked_policy> subj {};
+	for (int i = 0; i < 2000; ++i)
+		subj.insert(i);
+	for (int i = 0; i < 2000; i += 2) {
+		subj.erase(i);
+		ASSERT_TRUE(tc::is_avl_tree(subj)) << "after erasing " << i;
+	}
+	EXPECT_EQ(1000, subj.size());
+	// log2(1000) < 10, an AVL tree of 1000 keys is at most 14 levels deep.
+	EXPECT_GE(14, tc::tree_height(subj));
+}
+
+TEST(avl_tree_test, test_checked_random_sequence)
+{
+	std::srand(7);
+	tc::avl_tree<int, std::less<int>, tc::avl_checked_policy> subj {};
+	for (int i = 0; i < 20000; ++i) {
+		int x = rand() % 5000;
+		if (rand() % 3 == 0)
+			subj.erase(x);
+		else
+			subj.insert(x);
+	}
+	ASSERT_TRUE(tc::is_avl_tree(subj));
+}
+
+TEST(avl_tree_test, test_checked_detects_bad_balance)
+{
+	tc::avl_tree<int, std::less<int>, tc::avl_checked_policy> subj {};
+	subj.insert(2);
+	subj.insert(1);
+	subj.insert(3);
+	// Pretend the leaf is right heavy.
+	const_cast<tc::avl_node<int>*>(subj.croot()->left)->balance = 1;
+	EXPECT_THROW(subj.insert(0), std::logic_error);
+}
+
+TEST(avl_tree_test, test_stats)
+{
+	using tree_type = tc::avl_tree<int, std::less<int>, tc::avl_stats_policy>;
+	tree_type subj {};
+	subj.insert(1);
+	subj.insert(2);
+	subj.insert(3); // single rotation
+	subj.insert(6);
+	subj.insert(5); // double rotation
+
+	auto s = subj.stats();
+	EXPECT_EQ(5u, s.inserts);
+	EXPECT_EQ(1u, s.single_rotations);
+	EXPECT_EQ(1u, s.double_rotations);
+	EXPECT_EQ(5u, s.allocations);
+	EXPECT_EQ(5 * sizeof(tree_type::node_type), s.bytes_held);
+	EXPECT_LT(0u, s.comparisons);
+
+	subj.reset_stats();
+	EXPECT_TRUE(subj.contains(5));
+	EXPECT_FALSE(subj.contains(4));
+	s = subj.stats();
+	EXPECT_EQ(2u, s.lookups);
+	EXPECT_EQ(0u, s.inserts);
+	EXPECT_EQ(5 * sizeof(tree_type::node_type), s.bytes_held);
+	// 5 is found at the root's right child, 4 is missed below it.
+	EXPECT_EQ(2u + 3u, s.lookup_visits);
+
+	subj.erase(2);
+	s = subj.stats();
+	EXPECT_EQ(1u, s.erases);
+	EXPECT_EQ(1u, s.deallocations);
+	EXPECT_EQ(4 * sizeof(tree_type::node_type), s.bytes_held);
+}
+
+TEST(avl_tree_test, test_no_stats_by_default)
+{
+	tc::avl_tree<int> subj {};
+	subj.insert(1);
+	EXPECT_TRUE(subj.contains(1));
+	EXPECT_EQ(0u, subj.stats().comparisons);
+	EXPECT_EQ(0u, subj.stats().bytes_held);
+}
+
+TEST(avl_tree_test, test_three_way_one_comparison_per_level)
+{
+	tc::avl_tree<std::string, tc::three_way<std::string>, tc::avl_stats_policy> subj {};
+	std::srand(11);
+	for (int i = 0; i < 3000; ++i)
+		subj.insert("key-" + std::to_string(rand() % 2000));
+	for (int i = 0; i < 1000; ++i)
+		subj.erase("key-" + std::to_string(rand() % 2000));
+	ASSERT_TRUE(tc::is_avl_tree(subj));
+
+	auto s = subj.stats();
+	EXPECT_EQ(s.insert_visits + s.erase_visits, s.comparisons);
+
+	subj.reset_stats();
+	for (int i = 0; i < 100; ++i)
+		subj.contains("key-" + std::to_string(i));
+	s = subj.stats();
+	EXPECT_EQ(s.lookup_visits, s.comparisons);
+}
+
+TEST(avl_tree_test, test_less_comparator_fixup_does_not_compare)
+{
+	tc::avl_tree<int, std::less<int>, tc::avl_stats_policy> subj {};
+	for (int i = 0; i < 1000; ++i)
+		subj.insert(i);
+	// Ascending keys always go right: one failed less() and one successful
+	// less() per level, nothing extra for the balance pass.
+	auto s = subj.stats();
+	EXPECT_EQ(2 * s.insert_visits, s.comparisons);
+}
+
+TEST(avl_tree_test, test_three_way_adapter)
+{
+	tc::avl_tree<int, tc::three_way_adapter<std::greater<int>>, tc::avl_checked_policy> subj {};
+	for (int i = 0; i < 100; ++i)
+		subj.insert(i);
+	std::vector<int> val_trace;
+	tc::inorder_traverse(subj, [&](int v, unsigned) { val_trace.push_back(v); });
+	ASSERT_EQ(100u, val_trace.size());
+	EXPECT_EQ(99, val_trace.front());
+	EXPECT_EQ(0, val_trace.back());
+	EXPECT_TRUE(subj.contains(42));
+}
+
+TEST(avl_tree_test, test_validation_uses_the_comparator)
+{
+	tc::avl_tree<int, std::greater<int>> desc {};
+	tc::avl_tree<int, tc::three_way_adapter<std::greater<int>>> desc3 {};
+	for (int i = 0; i < 100; ++i) {
+		desc.insert(i);
+		desc3.insert(i);
+	}
+	EXPECT_TRUE(tc::is_avl_tree(desc));
+	EXPECT_TRUE(tc::is_avl_tree(desc3));
+
+	// A root and its left child with swapped keys are out of order.
+	std::swap(const_cast<int&>(desc.croot()->key), const_cast<int&>(desc.croot()->left->key));
+	std::swap(const_cast<int&>(desc3.croot()->key), const_cast<int&>(desc3.croot()->left->key));
+	EXPECT_FALSE(tc::is_bst(desc));
+	EXPECT_FALSE(tc::is_bst(desc3));
+}
+
+namespace
+{
+
+struct checked_prefix_policy : tc::avl_prefix_policy
+{
+	static const bool checked = true;
+	using stats_type = tc::avl_counting_stats;
+};
+
+struct checked_multiset_policy : tc::avl_multiset_policy
+{
+	static const bool checked = true;
+};
+
+}
+
+TEST(avl_tree_test, test_key_prefix)
+{
+	EXPECT_LT(tc::avl_key_prefix("abc").prefix, tc::avl_key_prefix("abd").prefix);
+	EXPECT_LT(tc::avl_key_prefix("ab").prefix, tc::avl_key_prefix("ab\x01").prefix);
+	EXPECT_LT(tc::avl_key_prefix("\x7f").prefix, tc::avl_key_prefix("\x80").prefix);
+	EXPECT_EQ(tc::avl_key_prefix("abcdefgh1").prefix, tc::avl_key_prefix("abcdefgh2").prefix);
+}
+
+TEST(avl_tree_test, test_prefix_policy)
+{
+	tc::avl_tree<std::string, tc::three_way<std::string>, checked_prefix_policy> subj {};
+	std::srand(5);
+	std::vector<std::string> keys;
+	std::set<std::string> model;
+	for (int i = 0; i < 2000; ++i) {
+		// Short keys, keys sharing the first 8 bytes and keys with zero bytes.
+		std::string k = std::to_string(rand() % 5000);
+		if (i % 3 == 0)
+			k = "prefix::" + k;
+		if (i % 7 == 0)
+			k += std::string(1, '\0') + "z";
+		keys.push_back(k);
+		subj.insert(k);
+		model.insert(k);
+	}
+	for (std::size_t i = 0; i < keys.size(); i += 3) {
+		subj.erase(keys[i]);
+		model.erase(keys[i]);
+	}
+
+	std::vector<std::string> val_trace;
+	tc::inorder_traverse(subj, [&](const std::string& v, unsigned) { val_trace.push_back(v); });
+	ASSERT_EQ(std::vector<std::string>(model.begin(), model.end()), val_trace);
+
+	subj.reset_stats();
+	for (const auto& k : keys)
+		ASSERT_EQ(model.count(k) != 0, subj.contains(k)) << k;
+	auto s = subj.stats();
+	// Only ties on the prefix reach the string comparison.
+	EXPECT_LT(s.comparisons, s.lookup_visits / 2);
+}
+
+TEST(avl_tree_test, test_multiset)
+{
+	tc::avl_tree<int, std::less<int>, checked_multiset_policy> subj {};
+	std::map<int, std::size_t> model;
+	std::srand(3);
+	for (int i = 0; i < 5000; ++i) {
+		// Heavily skewed towards small keys.
+		int x = (rand() % 64) * (rand() % 64) / 63;
+		subj.insert(x);
+		++model[x];
+	}
+	EXPECT_EQ(5000u, subj.size());
+	EXPECT_EQ(model.size(), subj.distinct_size());
+	for (const auto& kv : model)
+		ASSERT_EQ(kv.second, subj.count(kv.first));
+	EXPECT_EQ(0u, subj.count(1000));
+
+	for (int i = 0; i < 4000; ++i) {
+		int x = rand() % 64;
+		auto it = model.find(x);
+		if (it != model.end() && --it->second == 0)
+			model.erase(it);
+		subj.erase(x);
+	}
+	std::size_t total = 0;
+	for (const auto& kv : model) {
+		ASSERT_EQ(kv.second, subj.count(kv.first));
+		total += kv.second;
+	}
+	EXPECT_EQ(total, subj.size());
+	EXPECT_EQ(model.size(), subj.distinct_size());
+	ASSERT_TRUE(tc::is_avl_tree(subj));
+}
+
+TEST(avl_tree_test, test_set_count)
+{
+	tc::avl_tree<int> subj {};
+	subj.insert(1);
+	subj.insert(1);
+	EXPECT_EQ(1u, subj.size());
+	EXPECT_EQ(1u, subj.distinct_size());
+	EXPECT_EQ(1u, subj.count(1));
+	EXPECT_EQ(0u, subj.count(2));
+}
+
+namespace
+{
+
+struct checked_stats_policy : tc::avl_checked_policy
+{
+	using stats_type = tc::avl_counting_stats;
+};
+
+}
+
+TEST(avl_tree_test, test_append_monotonic_sequence)
+{
+	tc::avl_tree<int, std::less<int>, checked_stats_policy> subj {};
+	for (int i = 0; i < 10000; ++i)
+		subj.append(i);
+	EXPECT_EQ(10000u, subj.size());
+	ASSERT_TRUE(tc::is_avl_tree(subj));
+	// One look at the rightmost node per key, no descent.
+	EXPECT_EQ(10000u - 1, subj.stats().insert_visits);
+
+	// Not a new maximum: falls back to climbing from the rightmost node.
+	subj.append(-1);
+	subj.append(5000);
+	EXPECT_EQ(10001u, subj.size());
+	EXPECT_TRUE(subj.contains(-1));
+	ASSERT_TRUE(tc::is_avl_tree(subj));
+}
+
+TEST(avl_tree_test, test_hinted_nearly_sorted_sequence)
+{
+	tc::avl_tree<int, std::less<int>, checked_stats_policy> hinted {};
+	tc::avl_tree<int, std::less<int>, tc::avl_stats_policy> plain {};
+	std::srand(17);
+	auto hint = hinted.croot();
+	for (int i = 0; i < 20000; ++i) {
+		// Timestamps arriving almost in order.
+		int x = 4 * i + rand() % 16;
+		hint = hinted.insert(hint, x);
+		ASSERT_EQ(x, hint->key);
+		plain.insert(x);
+	}
+	ASSERT_EQ(plain.size(), hinted.size());
+	ASSERT_TRUE(tc::is_avl_tree(hinted));
+	EXPECT_LT(hinted.stats().insert_visits * 2, plain.stats().insert_visits);
+	EXPECT_LT(hinted.stats().comparisons * 4, plain.stats().comparisons);
+}
+
+TEST(avl_tree_test, test_hinted_insert_with_any_hint)
+{
+	tc::avl_tree<int, std::less<int>, tc::avl_checked_policy> subj {};
+	std::set<int> model;
+	std::vector<const tc::avl_tree<int>::node_type*> nodes;
+	std::srand(23);
+	for (int i = 0; i < 5000; ++i) {
+		int x = rand() % 3000;
+		auto hint = nodes.empty() || rand() % 10 == 0 ? nullptr : nodes[rand() % nodes.size()];
+		auto n = subj.insert(hint, x);
+		ASSERT_EQ(x, n->key);
+		if (model.insert(x).second)
+			nodes.push_back(n);
+	}
+	ASSERT_EQ(model.size(), subj.size());
+	std::vector<int> val_trace;
+	tc::inorder_traverse(subj, [&](int v, unsigned) { val_trace.push_back(v); });
+	EXPECT_EQ(std::vector<int>(model.begin(), model.end()), val_trace);
+}
+
+TEST(avl_tree_test, test_min_max)
+{
+	tc::avl_tree<int, std::less<int>, tc::avl_checked_policy> subj {};
+	std::srand(41);
+	std::set<int> model;
+	for (int i = 0; i < 3000; ++i) {
+		int x = rand() % 1000;
+		if (rand() % 4 == 0) {
+			subj.erase(x);
+			model.erase(x);
+		} else {
+			subj.insert(x);
+			model.insert(x);
+		}
+		if (!model.empty()) {
+			ASSERT_EQ(*model.begin(), subj.min());
+			ASSERT_EQ(*model.rbegin(), subj.max());
+		}
+	}
+}
+
+TEST(avl_tree_test, test_pop_min_max)
+{
+	tc::avl_tree<int, std::less<int>, checked_stats_policy> subj {};
+	std::srand(43);
+	std::multiset<int> model;
+	for (int i = 0; i < 2000; ++i) {
+		int x = rand();
+		subj.insert(x);
+		model.insert(x);
+	}
+	std::set<int> distinct(model.begin(), model.end());
+	subj.reset_stats();
+	while (distinct.size() > 1) {
+		ASSERT_EQ(*distinct.begin(), subj.pop_min());
+		distinct.erase(distinct.begin());
+		ASSERT_EQ(*distinct.rbegin(), subj.pop_max());
+		distinct.erase(std::prev(distinct.end()));
+	}
+	EXPECT_EQ(distinct.size(), subj.size());
+	// Popping never compares keys.
+	EXPECT_EQ(0u, subj.stats().comparisons);
+	ASSERT_TRUE(tc::is_avl_tree(subj));
+}
+
+TEST(avl_tree_test, test_pop_min_multiset)
+{
+	tc::avl_tree<int, std::less<int>, tc::avl_multiset_policy> subj {};
+	subj.insert(2);
+	subj.insert(1);
+	subj.insert(1);
+	EXPECT_EQ(1, subj.pop_min());
+	EXPECT_EQ(1, subj.min());
+	EXPECT_EQ(1, subj.pop_min());
+	EXPECT_EQ(2, subj.min());
+	EXPECT_EQ(2, subj.pop_max());
+	EXPECT_EQ(0u, subj.size());
+}
+
+TEST(avl_tree_test, test_find_batch)
+{
+	tc::avl_tree<int, std::less<int>, checked_stats_policy> subj {};
+	std::vector<int> keys;
+	for (int i = 0; i < 5000; ++i) {
+		subj.insert(i * 3);
+		keys.push_back(i * 5 % 15001); // hits and misses
+	}
+	keys.push_back(-1);
+
+	subj.reset_stats();
+	std::vector<const decltype(subj)::node_type*> expected;
+	for (int k : keys)
+		expected.push_back(subj.find(k));
+	const auto single = subj.stats();
+
+	subj.reset_stats();
+	std::vector<const decltype(subj)::node_type*> found;
+	subj.find_batch(keys, found);
+	EXPECT_EQ(expected, found);
+	// Same descents, only interleaved.
+	EXPECT_EQ(single.lookups, subj.stats().lookups);
+	EXPECT_EQ(single.lookup_visits, subj.stats().lookup_visits);
+
+	// Sizes around the batch width and the empty tree.
+	for (std::size_t n : {0u, 1u, 15u, 16u, 17u, 129u}) {
+		std::unique_ptr<bool[]> hit(new bool[n + 1]);
+		std::size_t hits = subj.contains_batch(keys.data(), n, hit.get());
+		std::size_t expected_hits = 0;
+		for (std::size_t i = 0; i < n; ++i) {
+			ASSERT_EQ(subj.contains(keys[i]), hit[i]) << n << " " << i;
+			expected_hits += hit[i];
+		}
+		EXPECT_EQ(expected_hits, hits);
+	}
+	tc::avl_tree<int> empty {};
+	empty.find_batch(keys, found);
+	EXPECT_EQ(std::vector<const tc::avl_tree<int>::node_type*>(keys.size(), nullptr), found);
+}
+
+TEST(avl_tree_test, test_find_batch_prefix)
+{
+	tc::avl_tree<std::string, tc::three_way<std::string>, checked_prefix_policy> subj {};
+	std::vector<std::string> keys;
+	for (int i = 0; i < 300; ++i) {
+		subj.insert("common/prefix/" + std::to_string(i * 2));
+		keys.push_back("common/prefix/" + std::to_string(i));
+	}
+	std::vector<const decltype(subj)::node_type*> found;
+	subj.find_batch(keys, found);
+	for (std::size_t i = 0; i < keys.size(); ++i)
+		EXPECT_EQ(subj.find(keys[i]), found[i]) << keys[i];
+}
+
+namespace
+{
+
+// Node by node: same keys, balances and shape.
+template<class Node>
+bool same_structure(const Node* a, const Node* b)
+{
+	if (a == nullptr || b == nullptr)
+		return a == b;
+	return a != b && a->key == b->key && a->balance == b->balance
+		&& same_structure(a->left, b->left) && same_structure(a->right, b->right);
+}
+
+}
+
+TEST(avl_tree_test, test_copy)
+{
+	tc::avl_tree<int, std::less<int>, checked_stats_policy> subj {};
+	std::srand(47);
+	for (int i = 0; i < 3000; ++i)
+		subj.insert(rand() % 10000);
+
+	auto copy = subj;
+	EXPECT_TRUE(same_structure(subj.croot(), copy.croot()));
+	EXPECT_TRUE(tc::is_avl_tree(copy));
+	EXPECT_EQ(subj.size(), copy.size());
+	EXPECT_EQ(subj.min(), copy.min());
+	EXPECT_EQ(subj.max(), copy.max());
+	// Cloning neither compares nor rotates.
+	EXPECT_EQ(0u, copy.stats().comparisons);
+	EXPECT_EQ(0u, copy.stats().single_rotations + copy.stats().double_rotations);
+	EXPECT_EQ(subj.stats().bytes_held, copy.stats().bytes_held);
+
+	// The copy is independent of the original.
+	copy.erase(copy.min());
+	copy.insert(-1);
+	EXPECT_FALSE(subj.contains(-1));
+	EXPECT_EQ(-1, copy.min());
+	EXPECT_TRUE(tc::is_avl_tree(subj));
+
+	subj = copy;
+	EXPECT_TRUE(same_structure(subj.croot(), copy.croot()));
+
+	tc::avl_tree<int> empty {};
+	tc::avl_tree<int> empty_copy(empty);
+	EXPECT_TRUE(empty_copy.empty());
+}
+
+TEST(avl_tree_test, test_copy_multiset)
+{
+	tc::avl_tree<int, std::less<int>, tc::avl_multiset_policy> subj {};
+	for (int i = 0; i < 100; ++i)
+		subj.insert(i % 7);
+	auto copy = subj;
+	EXPECT_EQ(100u, copy.size());
+	EXPECT_EQ(7u, copy.distinct_size());
+	for (int k = 0; k < 7; ++k)
+		EXPECT_EQ(subj.count(k), copy.count(k));
+}
+
+TEST(avl_tree_test, test_move_swap_clear)
+{
+	tc::avl_tree<int, std::less<int>, checked_stats_policy> a {};
+	for (int i = 0; i < 1000; ++i)
+		a.insert(i);
+	const auto* root = a.croot();
+	const auto held = a.stats().bytes_held;
+
+	auto b = std::move(a);
+	EXPECT_EQ(root, b.croot());
+	EXPECT_EQ(1000u, b.size());
+	EXPECT_EQ(held, b.stats().bytes_held);
+	EXPECT_TRUE(a.empty());
+	EXPECT_EQ(0u, a.size());
+	EXPECT_EQ(0u, a.stats().bytes_held);
+
+	a.insert(5);
+	swap(a, b);
+	EXPECT_EQ(root, a.croot());
+	EXPECT_EQ(1u, b.size());
+	EXPECT_EQ(5, b.min());
+
+	b = std::move(a);
+	EXPECT_EQ(root, b.croot());
+	EXPECT_EQ(held, b.stats().bytes_held);
+
+	b.clear();
+	EXPECT_TRUE(b.empty());
+	EXPECT_EQ(0u, b.stats().bytes_held);
+	EXPECT_EQ(1000u, b.stats().deallocations);
+	b.insert(3);
+	EXPECT_EQ(3, b.min());
+	EXPECT_EQ(3, b.max());
+}
+
+namespace
+{
+
+struct checked_filter_policy : checked_stats_policy
+{
+	using filter_type = tc::avl_bloom_filter<>;
+};
+
+struct checked_lazy_policy : checked_stats_policy
+{
+	using node_extra = tc::avl_tombstone<>;
+	static const bool lazy = true;
+};
+
+struct checked_lazy_filter_policy : checked_lazy_policy
+{
+	using filter_type = tc::avl_bloom_filter<>;
+};
+
+}
+
+TEST(avl_tree_test, test_filter_no_false_negatives)
+{
+	tc::avl_tree<int, std::less<int>, checked_filter_policy> subj {};
+	std::set<int> model;
+	std::srand(59);
+	// Growth, shrinking and regrowth go through several rebuilds.
+	for (int round = 0; round < 3; ++round) {
+		for (int i = 0; i < 4000; ++i) {
+			int x = std::rand() % 20000;
+			subj.insert(x);
+			model.insert(x);
+			ASSERT_TRUE(subj.contains(x));
+		}
+		for (int i = 0; i < 3500; ++i) {
+			int x = std::rand() % 20000;
+			subj.erase(x);
+			model.erase(x);
+			ASSERT_FALSE(subj.contains(x));
+		}
+		for (int x = 0; x < 20000; ++x)
+			ASSERT_EQ(model.count(x) != 0, subj.contains(x)) << x;
+	}
+	EXPECT_GT(subj.filter_stats().rebuilds, 3u);
+	EXPECT_EQ(model.size(), subj.size());
+}
+
+TEST(avl_tree_test, test_filter_built_by_updates)
+{
+	tc::avl_tree<int, std::less<int>, checked_filter_policy> subj {};
+	for (int i = 0; i < 1000; ++i)
+		subj.insert(i);
+	const auto built = subj.filter_stats().rebuilds;
+	EXPECT_GT(built, 0u);
+	// Const lookups only read the filter.
+	const auto& view = subj;
+	for (int i = 0; i < 2000; ++i)
+		ASSERT_EQ(i < 1000, view.contains(i));
+	EXPECT_EQ(built, subj.filter_stats().rebuilds);
+	EXPECT_EQ(2000u, subj.filter_stats().probes);
+
+	// Erasing most keys leaves the filter stale; the erases rebuild it.
+	for (int i = 0; i < 900; ++i)
+		subj.erase(i);
+	const auto shrunk = subj.filter_stats().rebuilds;
+	EXPECT_GT(shrunk, built);
+	subj.rebuild_filter();
+	EXPECT_EQ(shrunk + 1, subj.filter_stats().rebuilds);
+	for (int i = 0; i < 1000; ++i)
+		ASSERT_EQ(i >= 900, view.contains(i));
+}
+
+TEST(avl_tree_test, test_filter_answers_misses)
+{
+	tc::avl_tree<int, std::less<int>, checked_filter_policy> subj {};
+	for (int i = 0; i < 10000; ++i)
+		subj.insert(2 * i);
+	subj.reset_stats();
+	const auto before = subj.filter_stats();
+
+	for (int i = 0; i < 10000; ++i)
+		ASSERT_FALSE(subj.contains(2 * i + 1));
+	const auto f = subj.filter_stats();
+	const auto negatives = f.negatives - before.negatives;
+	const auto false_positives = f.false_positives - before.false_positives;
+	EXPECT_EQ(10000u, negatives + false_positives);
+	// About 1% at 10 bits per key; allow some slack.
+	EXPECT_LT(false_positives, 300u);
+	EXPECT_GT(f.false_positive_rate(), 0.0);
+	EXPECT_LT(f.false_positive_rate(), 0.03);
+	// Filtered misses do not descend at all.
+	EXPECT_EQ(10000u, subj.stats().lookups);
+	EXPECT_LT(subj.stats().lookup_visits, false_positives * 20);
+
+	// Batched lookups consult the filter as well.
+	std::vector<int> keys;
+	for (int i = 0; i < 1000; ++i)
+		keys.push_back(i);
+	std::vector<const decltype(subj)::node_type*> found;
+	subj.find_batch(keys, found);
+	for (int i = 0; i < 1000; ++i)
+		ASSERT_EQ(i % 2 == 0, found[i] != nullptr) << i;
+
+	auto copy = subj;
+	EXPECT_TRUE(copy.contains(42));
+	EXPECT_FALSE(copy.contains(43));
+	copy.clear();
+	EXPECT_FALSE(copy.contains(42));
+	copy.insert(42);
+	EXPECT_TRUE(copy.contains(42));
+}
+
+TEST(avl_tree_test, test_lazy_erase_does_not_restructure)
+{
+	tc::avl_tree<int, std::less<int>, checked_lazy_policy> subj {};
+	for (int i = 0; i < 100; ++i)
+		subj.append(i);
+	subj.reset_stats();
+
+	// Up to 25% of the nodes can be dead before a compaction.
+	for (int i = 1; i <= 20; ++i)
+		subj.erase(3 * i);
+	auto s = subj.stats();
+	EXPECT_EQ(20u, s.erases);
+	EXPECT_EQ(0u, s.single_rotations + s.double_rotations);
+	EXPECT_EQ(0u, s.deallocations);
+	EXPECT_EQ(20u, subj.dead_size());
+	EXPECT_EQ(80u, subj.size());
+	EXPECT_EQ(80u, subj.distinct_size());
+	EXPECT_TRUE(tc::is_avl_tree(subj));
+
+	EXPECT_FALSE(subj.contains(3));
+	EXPECT_EQ(0u, subj.count(3));
+	EXPECT_TRUE(subj.contains(4));
+	std::vector<int> keys {2, 3, 4, 100};
+	std::vector<const decltype(subj)::node_type*> found;
+	subj.find_batch(keys, found);
+	EXPECT_NE(nullptr, found[0]);
+	EXPECT_EQ(nullptr, found[1]);
+	EXPECT_NE(nullptr, found[2]);
+	EXPECT_EQ(nullptr, found[3]);
+
+	// Traversals only see live keys.
+	std::vector<int> seen;
+	tc::inorder_traverse(subj, [&](int v, unsigned) { seen.push_back(v); });
+	EXPECT_EQ(80u, seen.size());
+	EXPECT_TRUE(std::is_sorted(seen.begin(), seen.end()));
+	EXPECT_EQ(seen.end(), std::find(seen.begin(), seen.end(), 30));
+	std::size_t visited = 0;
+	tc::level_order_traverse(subj, [&](int, unsigned) { ++visited; });
+	EXPECT_EQ(80u, visited);
+
+	// Reinserting a dead key revives its node.
+	subj.insert(3);
+	EXPECT_TRUE(subj.contains(3));
+	EXPECT_EQ(19u, subj.dead_size());
+	EXPECT_EQ(0u, subj.stats().allocations);
+}
+
+TEST(avl_tree_test, test_lazy_erase_compacts)
+{
+	tc::avl_tree<int, std::less<int>, checked_lazy_policy> subj {};
+	for (int i = 0; i < 1000; ++i)
+		subj.append(i);
+	subj.reset_stats();
+	for (int i = 1; i < 999; ++i)
+		subj.erase(i);
+	// Compacted every time a quarter of the nodes was dead.
+	EXPECT_LT(subj.dead_size() * 4, subj.distinct_size() + subj.dead_size() + 1);
+	EXPECT_EQ(2u, subj.size());
+	EXPECT_EQ(998u, subj.stats().deallocations + subj.dead_size());
+	EXPECT_EQ(0u, subj.stats().single_rotations + subj.stats().double_rotations);
+	EXPECT_TRUE(tc::is_avl_tree(subj));
+
+	subj.compact();
+	EXPECT_EQ(0u, subj.dead_size());
+	EXPECT_EQ(0, subj.min());
+	EXPECT_EQ(999, subj.max());
+	EXPECT_TRUE(tc::is_avl_tree(subj));
+}
+
+TEST(avl_tree_test, test_lazy_revive_refills_filter)
+{
+	tc::avl_tree<int, std::less<int>, checked_lazy_filter_policy> subj {};
+	for (int i = 0; i < 1000; ++i)
+		subj.insert(i);
+	// Marked, not freed, and left out of the next rebuild.
+	for (int i = 100; i < 200; ++i)
+		subj.erase(i);
+	EXPECT_EQ(100u, subj.dead_size());
+	subj.rebuild_filter();
+	for (int i = 100; i < 200; ++i)
+		ASSERT_FALSE(subj.contains(i));
+
+	// Revived nodes go back into the filter.
+	for (int i = 100; i < 200; ++i)
+		subj.insert(i);
+	EXPECT_EQ(0u, subj.dead_size());
+	for (int i = 0; i < 1000; ++i) {
+		ASSERT_TRUE(subj.contains(i)) << i;
+		ASSERT_NE(nullptr, subj.find(i)) << i;
+		ASSERT_EQ(1u, subj.count(i)) << i;
+	}
+
+	// Also when growth rebuilds the filter while keys are dead.
+	for (int i = 300; i < 400; ++i)
+		subj.erase(i);
+	for (int i = 1000; i < 3000; ++i)
+		subj.insert(i);
+	for (int i = 300; i < 400; ++i)
+		subj.insert(i);
+	for (int i = 0; i < 3000; ++i)
+		ASSERT_TRUE(subj.contains(i)) << i;
+}
+
+TEST(avl_tree_test, test_lazy_erase_keeps_extremes)
+{
+	tc::avl_tree<int, std::less<int>, checked_lazy_policy> subj {};
+	for (int i = 0; i < 20; ++i)
+		subj.append(i);
+	subj.erase(1);
+	subj.erase(2);
+	subj.erase(0); // leftmost goes at once, then the dead 1 and 2 behind it
+	EXPECT_EQ(3, subj.min());
+	EXPECT_EQ(0u, subj.dead_size());
+	subj.erase(18);
+	EXPECT_EQ(1u, subj.dead_size());
+	EXPECT_EQ(19, subj.pop_max());
+	EXPECT_EQ(17, subj.max());
+	EXPECT_EQ(0u, subj.dead_size());
+	EXPECT_EQ(15u, subj.size());
+}
+
+TEST(avl_tree_test, test_lazy_random_sequence)
+{
+	tc::avl_tree<int, std::less<int>, checked_lazy_policy> subj {};
+	std::set<int> model;
+	std::srand(61);
+	for (int i = 0; i < 20000; ++i) {
+		int x = std::rand() % 2000;
+		switch (std::rand() % 3) {
+		case 0:
+			subj.insert(x);
+			model.insert(x);
+			break;
+		case 1:
+			subj.erase(x);
+			model.erase(x);
+			break;
+		default:
+			ASSERT_EQ(model.count(x) != 0, subj.contains(x)) << x;
+		}
+		ASSERT_EQ(model.size(), subj.size());
+		if (!model.empty()) {
+			ASSERT_EQ(*model.begin(), subj.min());
+			ASSERT_EQ(*model.rbegin(), subj.max());
+		}
+	}
+	std::vector<int> seen;
+	tc::inorder_traverse(subj, [&](int v, unsigned) { seen.push_back(v); });
+	EXPECT_TRUE(std::equal(model.begin(), model.end(), seen.begin(), seen.end()));
+
+	auto copy = subj;
+	EXPECT_EQ(subj.dead_size(), copy.dead_size());
+	copy.compact();
+	seen.clear();
+	tc::inorder_traverse(copy, [&](int v, unsigned) { seen.push_back(v); });
+	EXPECT_TRUE(std::equal(model.begin(), model.end(), seen.begin(), seen.end()));
+}
@@ -0,0 +1,130 @@
+#include "tc/btree.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <set>
+#include <string>
+#include <vector>
+
+TEST(btree_test, test_insert)
+{
+  tc::btree<int> subj {};
+  EXPECT_EQ(0u, subj.size());
+  EXPECT_TRUE(subj.begin() == subj.end());
+
+  for (int i = 5; i > 0; --i)
+    subj.insert(i);
+  subj.insert(3);
+
+  EXPECT_EQ(5u, subj.size());
+  EXPECT_EQ(std::vector<int>({1, 2, 3, 4, 5}), std::vector<int>(subj.begin(), subj.end()));
+  EXPECT_TRUE(subj.contains(4));
+  EXPECT_FALSE(subj.contains(6));
+  ASSERT_TRUE(subj.is_valid());
+}
+
+TEST(btree_test, test_random_sequence)
+{
+  // Small nodes so that the tree gets several levels deep.
+  tc::btree<int, std::less<int>, 64> subj {};
+  std::set<int> model;
+  std::srand(29);
+  for (int i = 0; i < 20000; ++i) {
+    int x = rand() % 4000;
+    if (rand() % 3 == 0) {
+      subj.erase(x);
+      model.erase(x);
+    } else {
+      subj.insert(x);
+      model.insert(x);
+    }
+    if (i % 500 == 0) {
+      ASSERT_TRUE(subj.is_valid()) << "at step " << i;
+    }
+  }
+  ASSERT_TRUE(subj.is_valid());
+  EXPECT_LT(2u, subj.height());
+  EXPECT_EQ(model.size(), subj.size());
+  EXPECT_EQ(std::vector<int>(model.begin(), model.end()), std::vector<int>(subj.begin(), subj.end()));
+
+  for (int x : std::vector<int>(model.begin(), model.end()))
+    subj.erase(x);
+  EXPECT_EQ(0u, subj.size());
+  EXPECT_EQ(0u, subj.height());
+  ASSERT_TRUE(subj.is_valid());
+}
+
+TEST(btree_test, test_string_keys)
+{
+  tc::btree<std::string, std::less<std::string>, 128> subj {};
+  std::set<std::string> model;
+  std::srand(31);
+  for (int i = 0; i < 3000; ++i) {
+    auto k = "key-" + std::to_string(rand() % 1000);
+    if (i % 4 == 3) {
+      subj.erase(k);
+      model.erase(k);
+    } else {
+      subj.insert(k);
+      model.insert(k);
+    }
+  }
+  ASSERT_TRUE(subj.is_valid());
+  EXPECT_EQ(std::vector<std::string>(model.begin(), model.end()),
+      std::vector<std::string>(subj.begin(), subj.end()));
+}
+
+TEST(btree_test, test_bulk_load)
+{
+  for (int n : {0, 1, 2, 7, 60, 61, 500, 12345}) {
+    std::vector<int> keys;
+    for (int i = 0; i < n; ++i)
+      keys.push_back(3 * i);
+    tc::btree<int, std::less<int>, 64> subj(keys.begin(), keys.end());
+    ASSERT_TRUE(subj.is_valid()) << n << " keys";
+    ASSERT_EQ((std::size_t)n, subj.size());
+    ASSERT_EQ(keys, std::vector<int>(subj.begin(), subj.end()));
+
+    // Loaded trees stay valid under updates.
+    for (int i = 0; i < n; i += 2)
+      subj.erase(3 * i);
+    for (int i = 0; i < n; ++i)
+      subj.insert(3 * i + 1);
+    ASSERT_TRUE(subj.is_valid()) << n << " keys";
+  }
+
+  std::vector<int> dups = {1, 1, 2, 3, 3, 3};
+  tc::btree<int> subj(dups.begin(), dups.end());
+  EXPECT_EQ(3u, subj.size());
+  ASSERT_TRUE(subj.is_valid());
+}
+
+TEST(btree_test, test_move)
+{
+  tc::btree<int> subj {};
+  for (int i = 0; i < 1000; ++i)
+    subj.insert(i);
+  tc::btree<int> other(std::move(subj));
+  EXPECT_EQ(0u, subj.size());
+  EXPECT_EQ(1000u, other.size());
+  subj = std::move(other);
+  EXPECT_EQ(1000u, subj.size());
+  ASSERT_TRUE(subj.is_valid());
+}
+
+TEST(btree_test, test_wide_node_lookups)
+{
+  // Page-sized leaves hold a thousand ints, searched by halving then scanning.
+  tc::btree<int, std::less<int>, 4096> subj {};
+  std::set<int> model;
+  std::srand(37);
+  for (int i = 0; i < 50000; ++i) {
+    int x = rand() % 100000;
+    subj.insert(x);
+    model.insert(x);
+  }
+  ASSERT_TRUE(subj.is_valid());
+  for (int x = 0; x < 100000; ++x)
+    ASSERT_EQ(model.count(x) != 0, subj.contains(x)) << x;
+}
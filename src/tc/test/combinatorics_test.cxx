@@ -0,0 +1,99 @@
+#include "tc/combinatorics.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <vector>
+
+namespace
+{
+
+// Pascal's triangle mod p, rows 0..n.
+std::vector<std::vector<std::uint32_t>> pascal(std::size_t n, std::uint32_t p)
+{
+  std::vector<std::vector<std::uint32_t>> c(n + 1);
+  for (std::size_t i = 0; i <= n; ++i) {
+    c[i].assign(i + 1, 1 % p);
+    for (std::size_t k = 1; k < i; ++k)
+      c[i][k] = (c[i - 1][k - 1] + c[i - 1][k]) % p;
+  }
+  return c;
+}
+
+}
+
+TEST(combinatorics_test, test_nck_matches_pascal)
+{
+  const std::uint32_t p = 1000000007;
+  tc::mod_combinatorics subj(p, 301);
+  auto c = pascal(300, p);
+  for (std::uint64_t n = 0; n <= 300; ++n) {
+    for (std::uint64_t k = 0; k <= n; ++k)
+      ASSERT_EQ(c[n][k], subj.nck(n, k)) << n << " " << k;
+    EXPECT_EQ(0u, subj.nck(n, n + 1));
+    EXPECT_EQ(c[n], subj.binomial_row(n));
+  }
+}
+
+TEST(combinatorics_test, test_npk_and_inverse)
+{
+  const std::uint32_t p = 998244353;
+  tc::mod_combinatorics subj(p, 50);
+  for (std::uint64_t n = 0; n < 50; ++n) {
+    std::uint64_t expected = 1;
+    for (std::uint64_t k = 0; k <= n; ++k) {
+      ASSERT_EQ(expected, subj.npk(n, k));
+      expected = expected * (n - k) % p;
+    }
+    if (n > 0) {
+      EXPECT_EQ(1u, std::uint64_t(subj.inverse(n)) * n % p);
+    }
+  }
+  EXPECT_THROW(subj.inverse(0), std::out_of_range);
+  EXPECT_THROW(subj.inverse(50), std::out_of_range);
+}
+
+TEST(combinatorics_test, test_lucas)
+{
+  // The table covers all residues of a small prime, so any n is allowed.
+  const std::uint32_t p = 7;
+  tc::mod_combinatorics subj(p, 1000);
+  EXPECT_EQ(7u, subj.size());
+  auto c = pascal(400, p);
+  for (std::uint64_t n = 0; n <= 400; ++n)
+    for (std::uint64_t k = 0; k <= n; ++k) {
+      ASSERT_EQ(c[n][k], subj.nck(n, k)) << n << " " << k;
+      std::uint64_t perm = 1;
+      for (std::uint64_t i = 0; i < k; ++i)
+        perm = perm * ((n - i) % p) % p;
+      ASSERT_EQ(perm, subj.npk(n, k)) << n << " " << k;
+    }
+  EXPECT_EQ(c[400], subj.binomial_row(400));
+  // Far beyond any table: base-7 digits of both arguments.
+  EXPECT_EQ(5u, subj.nck(1000000000000000000ull, 79792266297612001ull));
+  EXPECT_EQ(0u, subj.nck(1000000000000000000ull, 6));
+}
+
+TEST(combinatorics_test, test_out_of_table)
+{
+  tc::mod_combinatorics subj(1000000007, 10);
+  EXPECT_THROW(subj.nck(10, 3), std::out_of_range);
+  EXPECT_THROW(subj.npk(20, 15), std::out_of_range);
+  EXPECT_THROW(tc::mod_combinatorics(1, 10), std::invalid_argument);
+}
+
+TEST(combinatorics_test, test_compile_time_table)
+{
+  constexpr tc::static_mod_combinatorics<1000000007, 64> subj {};
+  static_assert(subj.nck(5, 2) == 10, "C(5, 2)");
+  static_assert(subj.npk(5, 2) == 20, "P(5, 2)");
+  static_assert(subj.factorial(20) == 146326063, "20! mod 1e9+7");
+
+  tc::mod_combinatorics runtime(1000000007, 64);
+  for (std::uint64_t n = 0; n < 64; ++n)
+    for (std::uint64_t k = 0; k <= n; ++k)
+      ASSERT_EQ(runtime.nck(n, k), subj.nck(n, k));
+
+  constexpr tc::static_mod_combinatorics<13, 13> small {};
+  static_assert(small.nck(100, 50) == 0, "Lucas at compile time");
+}
@@ -0,0 +1,165 @@
+#include "tc/gauss.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <numeric>
+#include <vector>
+
+namespace
+{
+
+const long long mod = 1000000007;
+
+using mll = tc::Matrix<long long>;
+using md = tc::Matrix<double>;
+
+mll random_mod(std::size_t rows, std::size_t cols, int seed)
+{
+  std::srand(seed);
+  mll m(mod, rows, cols);
+  for (std::size_t i = 0; i < rows; ++i)
+    for (std::size_t j = 0; j < cols; ++j)
+      m(i, j) = ((long long)std::rand() * std::rand()) % mod;
+  return m;
+}
+
+md random_real(std::size_t n, int seed)
+{
+  std::srand(seed);
+  md m(n, n);
+  for (std::size_t i = 0; i < n; ++i)
+    for (std::size_t j = 0; j < n; ++j)
+      m(i, j) = std::rand() / (double)RAND_MAX - 0.5;
+  return m;
+}
+
+// Sum over permutations, for small matrices.
+long long leibniz_det(const mll& m)
+{
+  std::vector<std::size_t> p(m.rows());
+  std::iota(p.begin(), p.end(), 0);
+  long long det = 0;
+  do {
+    long long term = 1;
+    for (std::size_t i = 0; i < p.size(); ++i)
+      term = term * m(i, p[i]) % mod;
+    std::size_t inversions = 0;
+    for (std::size_t i = 0; i < p.size(); ++i)
+      for (std::size_t j = i + 1; j < p.size(); ++j)
+        inversions += p[i] > p[j];
+    det = (det + (inversions % 2 ? mod - term : term)) % mod;
+  } while (std::next_permutation(p.begin(), p.end()));
+  return det;
+}
+
+double max_error(const md& a, const md& b)
+{
+  double e = 0;
+  for (std::size_t i = 0; i < a.rows(); ++i)
+    for (std::size_t j = 0; j < a.cols(); ++j)
+      e = std::max(e, std::abs(a(i, j) - b(i, j)));
+  return e;
+}
+
+}
+
+TEST(gauss_test, test_modular_det)
+{
+  for (int seed = 0; seed < 5; ++seed) {
+    auto m = random_mod(6, 6, seed);
+    EXPECT_EQ(leibniz_det(m), tc::det(m));
+  }
+  // Needs a row swap for the first pivot.
+  mll swap(mod, 2, 2);
+  swap(0, 1) = swap(1, 0) = 1;
+  EXPECT_EQ(mod - 1, tc::det(swap));
+
+  // det(AB) = det(A) det(B) across several panels.
+  auto a = random_mod(150, 150, 11), b = random_mod(150, 150, 12);
+  EXPECT_EQ(tc::det(a) * tc::det(b) % mod, tc::det(a * b));
+}
+
+TEST(gauss_test, test_modular_inverse_and_solve)
+{
+  auto a = random_mod(157, 157, 3);
+  auto id = a.identity();
+  EXPECT_EQ(id, a * tc::inverse(a));
+
+  auto b = random_mod(157, 5, 4);
+  auto x = tc::solve(a, b);
+  EXPECT_EQ(b, a * x);
+
+  // Entries outside [0, mod) are reduced first.
+  mll neg(mod, 2, 2);
+  neg(0, 0) = -1; neg(0, 1) = 2; neg(1, 0) = 3; neg(1, 1) = mod + 4;
+  mll reduced(mod, 2, 2);
+  reduced(0, 0) = mod - 1; reduced(0, 1) = 2; reduced(1, 0) = 3; reduced(1, 1) = 4;
+  EXPECT_EQ(tc::inverse(reduced), tc::inverse(neg));
+}
+
+TEST(gauss_test, test_rank)
+{
+  // A product through an inner dimension of 37 has rank 37.
+  auto low = random_mod(120, 37, 5) * random_mod(37, 90, 6);
+  EXPECT_EQ(37u, tc::rank(low));
+  EXPECT_EQ(0u, tc::det(random_mod(50, 20, 7) * random_mod(20, 50, 8)));
+  EXPECT_THROW(tc::inverse(random_mod(50, 20, 7) * random_mod(20, 50, 8)), std::runtime_error);
+
+  // Zero columns inside a panel shift the pivots off the diagonal.
+  auto m = random_mod(40, 70, 9);
+  for (std::size_t i = 0; i < m.rows(); ++i)
+    for (std::size_t j : {0u, 3u, 4u, 65u})
+      m(i, j) = 0;
+  EXPECT_EQ(40u, tc::rank(m));
+  EXPECT_EQ(0u, tc::rank(mll(mod, 3, 4)));
+
+  // Every block size factors the same matrix the same way.
+  auto reference = tc::lu_decompose(low, 1);
+  for (std::size_t block : {2u, 7u, 64u, 1000u}) {
+    auto d = tc::lu_decompose(low, block);
+    EXPECT_EQ(reference.lu, d.lu) << block;
+    EXPECT_EQ(reference.perm, d.perm) << block;
+    EXPECT_EQ(reference.pivots, d.pivots) << block;
+  }
+}
+
+TEST(gauss_test, test_floating_point)
+{
+  auto a = random_real(130, 21);
+  auto inv = tc::inverse(a);
+  EXPECT_LT(max_error(a.identity(), a * inv), 1e-9);
+
+  md b(130, 3);
+  for (std::size_t i = 0; i < 130; ++i)
+    for (std::size_t j = 0; j < 3; ++j)
+      b(i, j) = double(i + j);
+  EXPECT_LT(max_error(b, a * tc::solve(a, b)), 1e-9);
+
+  // Partial pivoting: a zero on the diagonal and a tiny one.
+  md p(3, 3);
+  p(0, 0) = 1e-20; p(0, 1) = 1; p(0, 2) = 2;
+  p(1, 0) = 1;     p(1, 1) = 1; p(1, 2) = 0;
+  p(2, 0) = 0;     p(2, 1) = 3; p(2, 2) = 1;
+  EXPECT_NEAR(5.0, tc::det(p), 1e-12);
+  EXPECT_LT(max_error(p.identity(), p * tc::inverse(p)), 1e-12);
+
+  // Dependent rows up to rounding.
+  md dep(3, 3);
+  for (std::size_t j = 0; j < 3; ++j) {
+    dep(0, j) = 0.1 * (j + 1);
+    dep(1, j) = 0.3 * (j + 1);
+    dep(2, j) = j * j;
+  }
+  EXPECT_EQ(2u, tc::rank(dep));
+  EXPECT_EQ(0.0, tc::det(dep));
+}
+
+TEST(gauss_test, test_argument_checks)
+{
+  EXPECT_THROW(tc::det(mll(mod, 2, 3)), std::runtime_error);
+  EXPECT_THROW(tc::rank(mll(3, 3)), std::runtime_error); // no modulo
+  EXPECT_THROW(tc::solve(random_mod(3, 3, 1), random_mod(4, 1, 1)), std::runtime_error);
+}
@@ -0,0 +1,118 @@
+#include "tc/matrix_batch.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <vector>
+
+namespace
+{
+
+using mll = tc::Matrix<long long>;
+
+// Odd sizes leave a partial last block.
+template<std::size_t N>
+tc::MatrixBatch<long long, N> random_batch(long long mod, std::size_t size, int seed)
+{
+  std::srand(seed);
+  tc::MatrixBatch<long long, N> b(mod, size);
+  for (std::size_t m = 0; m < size; ++m)
+    for (std::size_t i = 0; i < N; ++i)
+      for (std::size_t j = 0; j < N; ++j)
+        b(m, i, j) = mod ? (std::rand() * 65536ll + std::rand()) % mod : std::rand() % 100 - 50;
+  return b;
+}
+
+template<std::size_t N>
+void expect_products_match(long long mod, std::size_t size)
+{
+  auto a = random_batch<N>(mod, size, 1);
+  auto b = random_batch<N>(mod, size, 2);
+  auto c = a * b;
+  for (std::size_t m = 0; m < size; ++m)
+    ASSERT_EQ(a.get(m) * b.get(m), c.get(m)) << "N = " << N << ", m = " << m;
+}
+
+}
+
+TEST(matrix_batch_test, test_layout)
+{
+  tc::MatrixBatch<int, 2> b(100);
+  EXPECT_EQ(100u, b.size());
+  EXPECT_EQ(4u, b.blocks());
+  b(33, 1, 0) = 7;
+  EXPECT_EQ(7, b.lane(1, 1, 0)[1]);
+
+  mll m(3, 3);
+  EXPECT_THROW((tc::MatrixBatch<long long, 2>(10).set(0, m)), std::runtime_error);
+}
+
+TEST(matrix_batch_test, test_multiply)
+{
+  expect_products_match<2>(0, 77);
+  expect_products_match<3>(0, 77);
+  expect_products_match<4>(0, 77);
+  expect_products_match<2>(1000000007, 77);
+  expect_products_match<3>(1000000007, 77);
+  expect_products_match<4>(1000000007, 77);
+  expect_products_match<3>(998244353, 5);
+  // Too large for unreduced sums: every term is reduced on its own.
+  expect_products_match<4>(3037000493ll, 40);
+}
+
+TEST(matrix_batch_test, test_multiply_in_place)
+{
+  auto a = random_batch<3>(1000000007, 50, 3);
+  auto b = random_batch<3>(1000000007, 50, 4);
+  auto expected = a * b;
+  tc::multiply(a, b, a);
+  EXPECT_EQ(expected, a);
+
+  tc::MatrixBatch<long long, 3> other(7, 50);
+  EXPECT_THROW(tc::multiply(a, other, a), std::runtime_error);
+  EXPECT_THROW(tc::multiply(a, tc::MatrixBatch<long long, 3>(1000000007, 49), a), std::runtime_error);
+}
+
+TEST(matrix_batch_test, test_power)
+{
+  const long long mod = 1000000007;
+  auto b = random_batch<3>(mod, 45, 5);
+  for (unsigned p : {0u, 1u, 2u, 7u, 64u, 1000u}) {
+    auto r = tc::mpow(b, p);
+    for (std::size_t m = 0; m < b.size(); ++m)
+      ASSERT_EQ(tc::mpow(b.get(m), p), r.get(m)) << "p = " << p << ", m = " << m;
+  }
+}
+
+TEST(matrix_batch_test, test_power_per_matrix)
+{
+  // Fibonacci numbers F(e), one recurrence per matrix.
+  const long long mod = 1000000007;
+  const std::size_t size = 70;
+  tc::MatrixBatch<long long, 2> fib(mod, size);
+  std::vector<unsigned> e(size);
+  for (std::size_t m = 0; m < size; ++m) {
+    fib(m, 0, 0) = fib(m, 0, 1) = fib(m, 1, 0) = 1;
+    e[m] = static_cast<unsigned>(m * 37 % 91);
+  }
+  auto r = tc::mpow(fib, e);
+  for (std::size_t m = 0; m < size; ++m)
+    ASSERT_EQ(tc::mpow(fib.get(m), e[m]), r.get(m)) << "e = " << e[m];
+  EXPECT_THROW(tc::mpow(fib, std::vector<unsigned>(3)), std::runtime_error);
+}
+
+TEST(matrix_batch_test, test_floating_point)
+{
+  tc::MatrixBatch<double, 2> b(33);
+  for (std::size_t m = 0; m < b.size(); ++m) {
+    b(m, 0, 0) = 0.5;
+    b(m, 0, 1) = m;
+    b(m, 1, 1) = 2.0;
+  }
+  auto r = tc::mpow(b, 3);
+  for (std::size_t m = 0; m < b.size(); ++m) {
+    EXPECT_DOUBLE_EQ(0.125, r(m, 0, 0));
+    EXPECT_DOUBLE_EQ(5.25 * m, r(m, 0, 1));
+    EXPECT_DOUBLE_EQ(8.0, r(m, 1, 1));
+  }
+}
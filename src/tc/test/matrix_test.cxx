@@ -0,0 +1,284 @@
+#include "tc/matrix.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+
+namespace
+{
+
+using mll = tc::Matrix<long long>;
+
+mll random_matrix(std::size_t n, long long mod, int seed)
+{
+  std::srand(seed);
+  mll m(mod, n, n);
+  for (std::size_t i = 0; i < n; ++i)
+    for (std::size_t j = 0; j < n; ++j)
+      m(i, j) = std::rand() % 1000;
+  return m;
+}
+
+mll naive_power(const mll& m, unsigned p)
+{
+  mll r = m.identity();
+  for (unsigned i = 0; i < p; ++i) {
+    mll next(m.modulo(), m.rows(), m.cols());
+    for (std::size_t a = 0; a < m.rows(); ++a)
+      for (std::size_t b = 0; b < m.cols(); ++b)
+        for (std::size_t k = 0; k < m.cols(); ++k)
+          next(a, b) = (next(a, b) + r(a, k) * m(k, b)) % m.modulo();
+    r = next;
+  }
+  return r;
+}
+
+// Weighted digraph with some missing edges, given as a min-plus (max-plus) matrix.
+template<typename S>
+tc::Matrix<long long> random_graph(std::size_t n, int seed, bool negative)
+{
+  std::srand(seed);
+  tc::Matrix<long long> g(n, n);
+  for (std::size_t i = 0; i < n; ++i)
+    for (std::size_t j = 0; j < n; ++j)
+      g(i, j) = std::rand() % 3 == 0 ? S::zero() : std::rand() % 100 - (negative ? 30 : 0);
+  return g;
+}
+
+// Best walk of exactly k edges by relaxing one edge layer at a time.
+template<typename S>
+tc::Matrix<long long> layered_walks(const tc::Matrix<long long>& g, unsigned k)
+{
+  const std::size_t n = g.rows();
+  auto best = S::identity(0, n);
+  for (unsigned step = 0; step < k; ++step) {
+    tc::Matrix<long long> next(n, n);
+    next.reset(S::zero());
+    for (std::size_t s = 0; s < n; ++s)
+      for (std::size_t v = 0; v < n; ++v)
+        for (std::size_t w = 0; w < n; ++w)
+          next(s, w) = S::add(next(s, w), S::mul(best(s, v), g(v, w)));
+    best = next;
+  }
+  return best;
+}
+
+// m^p as p products from the semiring identity, entry by entry.
+template<typename S>
+tc::Matrix<long long> power_by_definition(const tc::Matrix<long long>& m, unsigned p)
+{
+  const std::size_t n = m.rows();
+  auto r = S::identity(m.modulo(), n);
+  for (unsigned step = 0; step < p; ++step) {
+    tc::Matrix<long long> next(m.modulo(), n, n);
+    next.reset(S::zero());
+    for (std::size_t i = 0; i < n; ++i)
+      for (std::size_t j = 0; j < n; ++j)
+        for (std::size_t k = 0; k < n; ++k) {
+          next(i, j) = S::add(next(i, j), S::mul(r(i, k), m(k, j)));
+          if (m.modulo() != 0)
+            next(i, j) %= m.modulo();
+        }
+    r = next;
+  }
+  return r;
+}
+
+template<typename S>
+void expect_small_powers(const tc::Matrix<long long>& m)
+{
+  for (unsigned p = 0; p <= 3; ++p)
+    EXPECT_EQ(power_by_definition<S>(m, p), tc::mpow(m, p, S())) << "p = " << p;
+}
+
+}
+
+TEST(matrix_test, test_plus_times_power)
+{
+  const long long mod = 1000000007;
+  auto m = random_matrix(7, mod, 1);
+  for (unsigned p = 0; p <= 9; ++p)
+    EXPECT_EQ(naive_power(m, p), tc::mpow(m, p)) << "p = " << p;
+}
+
+TEST(matrix_test, test_small_powers_every_semiring)
+{
+  // p = 2 once came out as m^3; pin the first exponents down.
+  expect_small_powers<tc::plus_times<long long>>(random_matrix(5, 1000000007, 11));
+  expect_small_powers<tc::plus_times<long long>>(random_matrix(5, 0, 12));
+  expect_small_powers<tc::min_plus<long long>>(random_graph<tc::min_plus<long long>>(5, 13, true));
+  expect_small_powers<tc::max_plus<long long>>(random_graph<tc::max_plus<long long>>(5, 14, true));
+  tc::Matrix<long long> g(5, 5);
+  std::srand(15);
+  for (std::size_t i = 0; i < 5; ++i)
+    for (std::size_t j = 0; j < 5; ++j)
+      g(i, j) = std::rand() % 3 == 0;
+  expect_small_powers<tc::or_and<long long>>(g);
+}
+
+TEST(matrix_test, test_plus_times_without_modulo)
+{
+  mll fib(2, 2);
+  fib(0, 0) = fib(0, 1) = fib(1, 0) = 1;
+  auto f = tc::mpow(fib, 50);
+  EXPECT_EQ(12586269025ll, f(0, 1));
+  EXPECT_EQ(20365011074ll, f(0, 0));
+}
+
+TEST(matrix_test, test_min_plus_shortest_walks)
+{
+  typedef tc::min_plus<long long> S;
+  // Odd size so the kernels have a tail after any vector width.
+  for (bool negative : {false, true}) {
+    auto g = random_graph<S>(37, 3, negative);
+    for (unsigned k : {0u, 1u, 2u, 5u, 8u})
+      EXPECT_EQ(layered_walks<S>(g, k), tc::mpow(g, k, S())) << "k = " << k;
+  }
+}
+
+TEST(matrix_test, test_max_plus_longest_walks)
+{
+  typedef tc::max_plus<long long> S;
+  for (bool negative : {false, true}) {
+    auto g = random_graph<S>(33, 5, negative);
+    for (unsigned k : {0u, 1u, 3u, 6u})
+      EXPECT_EQ(layered_walks<S>(g, k), tc::mpow(g, k, S())) << "k = " << k;
+  }
+}
+
+TEST(matrix_test, test_tropical_floating_point)
+{
+  typedef tc::min_plus<double> S;
+  const double inf = std::numeric_limits<double>::infinity();
+  EXPECT_EQ(inf, S::zero());
+
+  tc::Matrix<double> g(3, 3);
+  g.reset(inf);
+  g(0, 1) = 1.5;
+  g(1, 2) = -0.5;
+  g(0, 2) = 4.0;
+  auto two = tc::multiply(g, g, S());
+  EXPECT_EQ(1.0, two(0, 2));
+  EXPECT_EQ(inf, two(0, 1));
+  EXPECT_EQ(g, tc::multiply(S::identity(0, 3), g, S()));
+}
+
+TEST(matrix_test, test_or_and_reachability)
+{
+  typedef tc::or_and<int> S;
+  // A cycle of 70 nodes: wider than one 64-bit word.
+  const std::size_t n = 70;
+  tc::Matrix<int> g(n, n);
+  for (std::size_t i = 0; i < n; ++i)
+    g(i, (i + 1) % n) = 1;
+
+  for (unsigned k : {0u, 1u, 2u, 63u, 64u, 69u, 70u, 71u}) {
+    auto r = tc::mpow(g, k, S());
+    for (std::size_t i = 0; i < n; ++i)
+      for (std::size_t j = 0; j < n; ++j)
+        ASSERT_EQ(j == (i + k) % n ? 1 : 0, r(i, j)) << "k = " << k;
+  }
+
+  // Random 0/1 matrices against the definition.
+  std::srand(7);
+  tc::Matrix<int> a(9, 130), b(130, 67);
+  for (std::size_t i = 0; i < a.rows(); ++i)
+    for (std::size_t j = 0; j < a.cols(); ++j)
+      a(i, j) = std::rand() % 40 == 0;
+  for (std::size_t i = 0; i < b.rows(); ++i)
+    for (std::size_t j = 0; j < b.cols(); ++j)
+      b(i, j) = std::rand() % 40 == 0;
+  auto c = tc::multiply(a, b, S());
+  for (std::size_t i = 0; i < c.rows(); ++i)
+    for (std::size_t j = 0; j < c.cols(); ++j) {
+      int expected = 0;
+      for (std::size_t k = 0; k < a.cols(); ++k)
+        expected = S::add(expected, S::mul(a(i, k), b(k, j)));
+      ASSERT_EQ(expected, c(i, j));
+    }
+}
+
+TEST(matrix_test, test_shape_mismatch)
+{
+  mll a(2, 3), b(2, 3);
+  EXPECT_THROW(tc::multiply(a, b, tc::min_plus<long long>()), std::runtime_error);
+  EXPECT_THROW(tc::mpow(a, 0, tc::max_plus<long long>()), std::runtime_error);
+}
+
+TEST(matrix_test, test_plus_times_unreduced_entries)
+{
+  // Entries outside [0, mod) skip the delayed-reduction kernel.
+  const long long mod = 1000000007;
+  mll a(mod, 2, 2), b(mod, 2, 2);
+  a(0, 0) = mod + 1; a(0, 1) = 2; a(1, 0) = 3; a(1, 1) = 4;
+  b(0, 0) = 5; b(0, 1) = 6; b(1, 0) = 7; b(1, 1) = 8;
+  auto c = a * b;
+  EXPECT_EQ(19, c(0, 0));
+  EXPECT_EQ(22, c(0, 1));
+  EXPECT_EQ(43, c(1, 0));
+  EXPECT_EQ(50, c(1, 1));
+}
+
+TEST(matrix_test, test_views)
+{
+  mll m(4, 5);
+  for (std::size_t i = 0; i < 4; ++i)
+    for (std::size_t j = 0; j < 5; ++j)
+      m(i, j) = 10 * i + j;
+
+  auto b = m.view().block(1, 2, 2, 3);
+  EXPECT_EQ(2u, b.rows());
+  EXPECT_EQ(3u, b.cols());
+  EXPECT_EQ(12, b(0, 0));
+  EXPECT_EQ(24, b(1, 2));
+  auto t = b.transposed();
+  EXPECT_EQ(3u, t.rows());
+  EXPECT_EQ(23, t(1, 1));
+  EXPECT_FALSE(t.has_contiguous_rows());
+  EXPECT_EQ(22, t.row_slice(0)(0, 1));
+  EXPECT_EQ(24, t.col_slice(1)(2, 0));
+  EXPECT_THROW(m.view().block(3, 0, 2, 1), std::out_of_range);
+
+  // Writes go to the viewed matrix.
+  m.view().col_slice(0).fill(-1);
+  m.view().block(0, 3, 2, 2).transposed()(1, 0) = 99;
+  EXPECT_EQ(-1, m(3, 0));
+  EXPECT_EQ(99, m(0, 4));
+
+  mll copy(m.view().block(1, 1, 2, 2));
+  EXPECT_EQ(11, copy(0, 0));
+  EXPECT_TRUE(copy == m.view().block(1, 1, 2, 2));
+  EXPECT_TRUE(m.view().block(1, 1, 2, 2) == copy);
+  EXPECT_FALSE(copy == m.view().block(1, 2, 2, 2));
+  EXPECT_FALSE(copy == m.view());
+}
+
+TEST(matrix_test, test_view_products)
+{
+  const long long mod = 1000000007;
+  auto a = random_matrix(9, mod, 11);
+  auto b = random_matrix(9, mod, 12);
+  mll at(a.view().transposed());
+  mll bt(b.view().transposed());
+
+  // Strided right operands are packed, strided left ones read in place.
+  EXPECT_EQ(at * b, a.view().transposed() * b);
+  EXPECT_EQ(a * bt, a * b.view().transposed());
+  EXPECT_EQ(at * bt, a.view().transposed() * b.view().transposed());
+  mll a_block(a.view().block(2, 1, 4, 6)), b_block(b.view().block(3, 0, 6, 5));
+  EXPECT_EQ(a_block * b_block, a.view().block(2, 1, 4, 6) * b.view().block(3, 0, 6, 5));
+  EXPECT_EQ(a * bt, tc::multiply(a.view(), b.view().transposed(), tc::plus_times<long long>()));
+
+  typedef tc::min_plus<long long> S;
+  auto g = random_graph<S>(12, 13, false);
+  mll gt(g.view().transposed());
+  EXPECT_EQ(tc::mpow(gt, 5, S()), tc::mpow(g.view().transposed(), 5, S()));
+  EXPECT_EQ(tc::multiply(gt, g, S()), tc::multiply(g.view().transposed(), g, S()));
+  EXPECT_EQ(tc::multiply(g, gt, tc::or_and<long long>()), tc::multiply(g, g.view().transposed(), tc::or_and<long long>()));
+
+  EXPECT_EQ(tc::mpow(at, 6), tc::mpow(a.view().transposed(), 6));
+  EXPECT_THROW(tc::mpow(a.view().block(0, 0, 2, 3), 2), std::runtime_error);
+}
@@ -0,0 +1,96 @@
+#include "tc/avl_tree.h"
+#include "tc/parallel.h"
+#include "tc/tree.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+tc::avl_tree<int> make_tree(int n)
+{
+  tc::avl_tree<int> tree {};
+  for (int i = 0; i < n; ++i)
+    tree.insert((i * 7919) % n);
+  return tree;
+}
+
+}
+
+TEST(parallel_test, test_reduce_sum)
+{
+  auto subj = make_tree(20000);
+  tc::work_stealing_pool pool(4);
+
+  long long expected = 0;
+  tc::inorder_traverse(subj, [&](int v, unsigned) { expected += v; });
+
+  auto sum = tc::parallel_reduce(subj,
+      [](int v, unsigned) { return (long long)v; },
+      [](long long a, long long b) { return a + b; },
+      pool);
+  EXPECT_EQ(expected, sum);
+}
+
+TEST(parallel_test, test_reduce_keeps_key_order)
+{
+  auto subj = make_tree(3000);
+  tc::work_stealing_pool pool(3);
+
+  std::vector<int> expected;
+  tc::inorder_traverse(subj, [&](int v, unsigned) { expected.push_back(v); });
+
+  // Concatenation is associative but not commutative.
+  auto trace = tc::parallel_reduce(subj,
+      [](int v, unsigned) { return std::vector<int>{v}; },
+      [](std::vector<int> a, const std::vector<int>& b) {
+        a.insert(a.end(), b.begin(), b.end());
+        return a;
+      },
+      pool);
+  EXPECT_EQ(expected, trace);
+}
+
+TEST(parallel_test, test_for_each_level_histogram)
+{
+  auto subj = make_tree(5000);
+  tc::work_stealing_pool pool(4);
+
+  std::vector<unsigned> expected(64);
+  tc::level_order_traverse(subj, [&](int, unsigned level) { ++expected[level]; });
+
+  std::vector<std::atomic<unsigned>> hist(64);
+  tc::parallel_for_each(subj, [&](int, unsigned level) { ++hist[level]; }, pool);
+
+  for (std::size_t i = 0; i < expected.size(); ++i)
+    EXPECT_EQ(expected[i], hist[i].load()) << "level " << i;
+}
+
+TEST(parallel_test, test_empty_and_small_trees)
+{
+  tc::avl_tree<int> empty {};
+  auto count = tc::parallel_reduce(empty,
+      [](int, unsigned) { return 1; },
+      [](int a, int b) { return a + b; });
+  EXPECT_EQ(0, count);
+
+  auto small = make_tree(3);
+  count = tc::parallel_reduce(small,
+      [](int, unsigned) { return 1; },
+      [](int a, int b) { return a + b; });
+  EXPECT_EQ(3, count);
+}
+
+TEST(parallel_test, test_exception_is_propagated)
+{
+  auto subj = make_tree(1000);
+  tc::work_stealing_pool pool(2);
+  EXPECT_THROW(tc::parallel_for_each(subj, [](int v, unsigned) {
+    if (v == 500)
+      throw std::runtime_error("boom");
+  }, pool), std::runtime_error);
+}
@@ -0,0 +1,50 @@
+#include "tc/avl_tree.h"
+#include "tc/perf_counters.h"
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <string>
+
+TEST(perf_counters_test, test_scope)
+{
+  tc::perf_counters counters;
+  tc::perf_sample sample;
+  tc::avl_tree<int> tree {};
+  {
+    tc::perf_scope scope(counters, sample);
+    for (int i = 0; i < 10000; ++i)
+      tree.insert(i * 7919 % 10000);
+  }
+  EXPECT_EQ(10000u, tree.size());
+  EXPECT_GT(sample.seconds, 0.0);
+  // Counters are usually unavailable in containers; check them only if open.
+  if (counters.available() && sample.has(tc::perf_instructions)) {
+    EXPECT_GT(sample[tc::perf_instructions], 10000u);
+  }
+
+  std::ostringstream os;
+  tc::write_per_op(os, sample, tree.size());
+  EXPECT_NE(std::string::npos, os.str().find(" ns"));
+  EXPECT_NE(std::string::npos, os.str().find("per op"));
+}
+
+TEST(perf_counters_test, test_timing_only_fallback)
+{
+  tc::perf_counters counters(false);
+  EXPECT_FALSE(counters.available());
+  tc::perf_sample sample;
+  {
+    tc::perf_scope scope(counters, sample);
+    volatile int sink = 0;
+    for (int i = 0; i < 100000; ++i)
+      sink += i;
+  }
+  EXPECT_GT(sample.seconds, 0.0);
+  for (int e = 0; e < tc::perf_event_count; ++e)
+    EXPECT_FALSE(sample.has(tc::perf_event(e)));
+
+  std::ostringstream os;
+  tc::write_per_op(os, sample, 10);
+  EXPECT_EQ(std::string::npos, os.str().find("cycles"));
+}
@@ -0,0 +1,96 @@
+#include "tc/small_set.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <set>
+#include <string>
+#include <vector>
+
+TEST(small_set_test, test_inline)
+{
+  tc::small_set<int, 4> subj {};
+  EXPECT_TRUE(subj.empty());
+  EXPECT_TRUE(subj.begin() == subj.end());
+
+  EXPECT_TRUE(subj.insert(3));
+  EXPECT_TRUE(subj.insert(1));
+  EXPECT_FALSE(subj.insert(3));
+  EXPECT_TRUE(subj.insert(2));
+  EXPECT_EQ(3u, subj.size());
+  EXPECT_TRUE(subj.is_inline());
+  EXPECT_EQ(std::vector<int>({1, 2, 3}), std::vector<int>(subj.begin(), subj.end()));
+  ASSERT_NE(nullptr, subj.find(2));
+  EXPECT_EQ(2, *subj.find(2));
+  EXPECT_EQ(nullptr, subj.find(4));
+  EXPECT_TRUE(subj.erase(1));
+  EXPECT_FALSE(subj.erase(1));
+  EXPECT_EQ(std::vector<int>({2, 3}), std::vector<int>(subj.begin(), subj.end()));
+}
+
+TEST(small_set_test, test_promote_and_demote)
+{
+  tc::small_set<int, 4> subj {};
+  for (int i = 0; i < 4; ++i)
+    subj.insert(i * 10);
+  EXPECT_TRUE(subj.is_inline());
+  subj.insert(5);
+  EXPECT_FALSE(subj.is_inline());
+  EXPECT_EQ(std::vector<int>({0, 5, 10, 20, 30}), std::vector<int>(subj.begin(), subj.end()));
+
+  // Hysteresis: back to the array only at N / 2 keys.
+  subj.erase(30);
+  subj.erase(20);
+  EXPECT_FALSE(subj.is_inline());
+  subj.erase(0);
+  EXPECT_TRUE(subj.is_inline());
+  EXPECT_EQ(std::vector<int>({5, 10}), std::vector<int>(subj.begin(), subj.end()));
+  EXPECT_TRUE(subj.contains(5));
+  EXPECT_FALSE(subj.contains(0));
+}
+
+TEST(small_set_test, test_random_sequence)
+{
+  tc::small_set<int, 8> subj {};
+  std::set<int> model;
+  std::srand(53);
+  for (int i = 0; i < 20000; ++i) {
+    int x = std::rand() % 24;
+    if (std::rand() % 2) {
+      ASSERT_EQ(model.insert(x).second, subj.insert(x));
+    } else {
+      ASSERT_EQ(model.erase(x) != 0, subj.erase(x));
+    }
+    ASSERT_EQ(model.size(), subj.size());
+    ASSERT_EQ(model.count(x) != 0, subj.contains(x));
+    if (i % 97 == 0) {
+      ASSERT_EQ(std::vector<int>(model.begin(), model.end()), std::vector<int>(subj.begin(), subj.end()));
+    }
+  }
+}
+
+TEST(small_set_test, test_copy_move_strings)
+{
+  tc::small_set<std::string, 3> a {};
+  for (const char* s : {"pear", "apple", "fig"})
+    a.insert(s);
+  auto b = a;
+  b.insert("kiwi");
+  EXPECT_TRUE(a.is_inline());
+  EXPECT_FALSE(b.is_inline());
+  EXPECT_EQ(std::vector<std::string>({"apple", "fig", "pear"}), std::vector<std::string>(a.begin(), a.end()));
+
+  auto c = b;
+  EXPECT_EQ(std::vector<std::string>(b.begin(), b.end()), std::vector<std::string>(c.begin(), c.end()));
+  c.erase("kiwi");
+  EXPECT_TRUE(b.contains("kiwi"));
+
+  auto d = std::move(b);
+  EXPECT_EQ(4u, d.size());
+  EXPECT_TRUE(b.empty());
+  a = d;
+  EXPECT_EQ(4u, a.size());
+  swap(a, c);
+  EXPECT_EQ(3u, a.size());
+  EXPECT_EQ(4u, c.size());
+}
@@ -0,0 +1,108 @@
+#include "tc/avl_tree.h"
+#include "tc/btree.h"
+#include "tc/trace.h"
+#include "tc/tree.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <vector>
+
+TEST(trace_test, test_round_trip)
+{
+  std::ostringstream os;
+  {
+    // Tiny buffer so that records cross block boundaries.
+    tc::trace_writer<std::int64_t> writer(os, 3);
+    for (std::int64_t i = 0; i < 100; ++i)
+      writer.record(static_cast<tc::trace_op>(i % 3), i * 1000000007ll);
+    EXPECT_EQ(100u, writer.records());
+  }
+  const std::string bytes = os.str();
+  EXPECT_EQ(16u + 100u * 9u, bytes.size());
+
+  tc::trace_view<std::int64_t> view(bytes.data(), bytes.size());
+  ASSERT_EQ(100u, view.size());
+  for (std::size_t i = 0; i < view.size(); ++i) {
+    EXPECT_EQ(static_cast<tc::trace_op>(i % 3), view.op(i));
+    EXPECT_EQ(std::int64_t(i) * 1000000007ll, view.key(i));
+  }
+
+  // A partial last record is ignored.
+  tc::trace_view<std::int64_t> cut(bytes.data(), bytes.size() - 4);
+  EXPECT_EQ(99u, cut.size());
+}
+
+TEST(trace_test, test_bad_header)
+{
+  std::ostringstream os;
+  {
+    tc::trace_writer<std::int32_t> writer(os);
+    writer.record(tc::trace_op::insert, 1);
+  }
+  std::string bytes = os.str();
+  EXPECT_EQ(4u, tc::trace_view<std::int32_t>::key_size(bytes.data(), bytes.size()));
+  EXPECT_THROW(tc::trace_view<std::int64_t>(bytes.data(), bytes.size()), std::invalid_argument);
+  EXPECT_THROW(tc::trace_view<std::int32_t>(bytes.data(), 10), std::invalid_argument);
+  bytes[0] = 'X';
+  EXPECT_THROW(tc::trace_view<std::int32_t>(bytes.data(), bytes.size()), std::invalid_argument);
+}
+
+TEST(trace_test, test_bad_op)
+{
+  std::ostringstream os;
+  {
+    tc::trace_writer<std::int32_t> writer(os);
+    for (int i = 0; i < 10; ++i)
+      writer.record(tc::trace_op::insert, i);
+  }
+  std::string bytes = os.str();
+  bytes[16 + 7 * 5] = 3;
+  try {
+    tc::trace_view<std::int32_t> view(bytes.data(), bytes.size());
+    FAIL() << "corrupt op accepted";
+  } catch (const std::invalid_argument& e) {
+    EXPECT_NE(std::string::npos, std::string(e.what()).find("record 7"));
+  }
+  // A cut trace is checked up to its last whole record only.
+  EXPECT_EQ(7u, tc::trace_view<std::int32_t>(bytes.data(), 16 + 7 * 5 + 3).size());
+}
+
+TEST(trace_test, test_record_and_replay)
+{
+  std::ostringstream os;
+  tc::traced_tree<tc::avl_tree<int>> recorded {};
+  {
+    tc::trace_writer<int> writer(os);
+    recorded.set_writer(&writer);
+    std::srand(17);
+    for (int i = 0; i < 2000; ++i) {
+      int x = std::rand() % 500;
+      switch (std::rand() % 3) {
+      case 0: recorded.insert(x); break;
+      case 1: recorded.erase(x); break;
+      case 2: recorded.contains(x); break;
+      }
+    }
+    recorded.set_writer(nullptr);
+    recorded.insert(1000); // not recorded
+  }
+
+  const std::string bytes = os.str();
+  tc::trace_view<int> trace(bytes.data(), bytes.size());
+  EXPECT_EQ(2000u, trace.size());
+
+  // Replaying into other variants reproduces the same set.
+  tc::avl_tree<int> avl {};
+  tc::btree<int> bt {};
+  EXPECT_EQ(tc::replay(trace, avl), tc::replay(trace, bt));
+
+  std::vector<int> expected, from_avl;
+  tc::inorder_traverse(recorded.tree(), [&](int v, unsigned) { if (v != 1000) expected.push_back(v); });
+  tc::inorder_traverse(avl, [&](int v, unsigned) { from_avl.push_back(v); });
+  EXPECT_EQ(expected, from_avl);
+  EXPECT_EQ(expected, std::vector<int>(bt.begin(), bt.end()));
+}
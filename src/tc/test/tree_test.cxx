@@ -4,6 +4,7 @@
 #include <gtest/gtest.h>
 #include <vector>
 #include <iostream>
+#include <sstream>
 
 namespace
 {
@@ -168,6 +169,30 @@ TEST(tree_test, test_is_not_bst_tricky)
     ASSERT_FALSE(tc::is_bst(subj));
 }
 
+TEST(tree_test, test_degenerate_tree_does_not_overflow_stack)
+{
+  // A list this long would blow the call stack of a recursive checker.
+  tnode* root = mnode(0);
+  auto last = root;
+  for (int i = 1; i < 1000000; ++i) {
+    last->right = mnode(i);
+    last->right->parent = last;
+    last = last->right;
+  }
+  ttree subj = { root };
+  ASSERT_TRUE(tc::is_bst(subj));
+  ASSERT_FALSE(tc::is_avl_balanced_tree(subj));
+  ASSERT_FALSE(tc::is_avl_tree(subj));
+}
+
+TEST(tree_test, test_broken_parent_link_is_not_bst)
+{
+  auto child = mnode(5);
+  ttree subj = { mnode(child, nullptr, 9) };
+  child->parent = child;
+  ASSERT_FALSE(tc::is_bst(subj));
+}
+
 // avl balance test cases
 
 TEST(tree_test, trivial_trees_are_avl_balanced)
@@ -278,3 +303,155 @@ TEST(tree_test, test_left_heavy_tree_is_not_avl_balanced)
   };
   ASSERT_FALSE(tc::is_avl_balanced_tree(subj));
 }
+
+// height and level order test cases
+
+TEST(tree_test, test_tree_height)
+{
+  ASSERT_EQ(0, tc::tree_height(ttree{nullptr}));
+  ASSERT_EQ(1, tc::tree_height(ttree{mnode(1)}));
+  ttree subj = {
+    mnode(
+      mnode(3),
+      mnode(
+        mnode(
+          mnode(7),
+          nullptr,
+          11
+         ),
+        nullptr,
+      -7
+      ),
+      0
+    )
+  };
+  ASSERT_EQ(4, tc::tree_height(subj));
+}
+
+TEST(tree_test, test_avl_tree_height_from_balance)
+{
+  tc::avl_tree<int> subj {};
+  ASSERT_EQ(0, tc::tree_height(subj));
+  for (int i = 0; i < 1000; ++i)
+    subj.insert(i);
+  // A perfect tree of 1023 nodes would be 10 levels, the AVL bound is 14.
+  int h = tc::tree_height(subj);
+  ASSERT_LE(10, h);
+  ASSERT_GE(14, h);
+
+  unsigned deepest = 0;
+  tc::preorder_traverse(subj, [&](int, unsigned level) { deepest = std::max(deepest, level); });
+  ASSERT_EQ(deepest, (unsigned)h);
+}
+
+TEST(tree_test, test_stale_balance_is_not_avl_balanced)
+{
+  tc::avl_tree<int> subj {};
+  subj.insert(1);
+  subj.insert(2);
+  ASSERT_TRUE(tc::is_avl_balanced_tree(subj));
+  const_cast<tc::avl_node<int>*>(subj.croot())->balance = 0;
+  ASSERT_FALSE(tc::is_avl_balanced_tree(subj));
+}
+
+TEST(tree_test, test_level_order_empty_tree)
+{
+  unsigned calls = 0;
+  tc::level_order_traverse(ttree{nullptr}, [&](int, unsigned) { ++calls; });
+  ASSERT_EQ(0u, calls);
+}
+
+TEST(tree_test, test_level_order_reuses_buffer)
+{
+  ttree subj = {
+    mnode(
+      mnode(mnode(1), nullptr, 2),
+      mnode(5),
+      4
+    )
+  };
+  std::vector<const tnode*> buffer;
+  std::vector<int> val_trace;
+  std::vector<unsigned> lvl_trace;
+  for (int pass = 0; pass < 2; ++pass) {
+    val_trace.clear();
+    lvl_trace.clear();
+    tc::level_order_traverse(subj, [&](int v, unsigned level) {
+      val_trace.push_back(v);
+      lvl_trace.push_back(level);
+    }, buffer);
+  }
+  EXPECT_EQ(std::vector<int>({4, 2, 5, 1}), val_trace);
+  EXPECT_EQ(std::vector<unsigned>({1, 2, 2, 3}), lvl_trace);
+  EXPECT_EQ(4u, buffer.size());
+}
+
+// dump test cases
+
+TEST(tree_test, test_dump_tree)
+{
+  tc::avl_tree<int> subj {};
+  for (int i = 1; i <= 5; ++i)
+    subj.insert(i);
+
+  std::ostringstream os;
+  tc::dump_tree(subj, os);
+  EXPECT_EQ(
+    "2(+1)\n"
+    "  L 1(0)\n"
+    "  R 4(0)\n"
+    "    L 3(0)\n"
+    "    R 5(0)\n", os.str());
+
+  os.str("");
+  tc::dump_tree(subj, os, 2);
+  EXPECT_EQ(
+    "2(+1)\n"
+    "  L 1(0)\n"
+    "  R 4(0) ...\n", os.str());
+
+  os.str("");
+  tc::dump_tree(subj, os, 10, 2);
+  EXPECT_EQ(
+    "2(+1)\n"
+    "  L 1(0)\n"
+    "... stopped after 2 nodes\n", os.str());
+}
+
+TEST(tree_test, test_dump_tree_without_balance)
+{
+  ttree subj = { mnode(nullptr, mnode(99), 2) };
+  std::ostringstream os;
+  tc::dump_tree(subj, os);
+  EXPECT_EQ("2\n  R 99\n", os.str());
+}
+
+TEST(tree_test, test_write_dot)
+{
+  tc::avl_tree<int> subj {};
+  subj.insert(1);
+  subj.insert(2);
+
+  std::ostringstream os;
+  tc::write_dot(subj, os);
+  EXPECT_EQ(
+    "digraph tree {\n"
+    "  node [shape=ellipse];\n"
+    "  n0 [label=\"1(+1)\"];\n"
+    "  n0L [shape=point];\n"
+    "  n0 -> n0L;\n"
+    "  n1 [label=\"2(0)\"];\n"
+    "  n0 -> n1;\n"
+    "}\n", os.str());
+}
+
+TEST(tree_test, test_print_tree_writes_to_given_stream)
+{
+  ttree subj = { mnode(mnode(5), mnode(11), 9) };
+  std::ostringstream os;
+  tc::print_tree(subj, os);
+  EXPECT_EQ(
+    "Total levels 1\n"
+    "                 9\n"
+    "           5          11\n", os.str());
+}